@@ -0,0 +1,192 @@
+// Batch processing support shared by the programs: a fixed-size pool of
+// worker threads, and the inputs of a batch run.
+
+#include "batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace ComputerVisionProjects {
+
+ThreadPool::ThreadPool(size_t num_threads)
+  : task_{nullptr}, count_{0}, next_{0}, busy_workers_{0}, failures_{0},
+    generation_{0}, stopping_{false} {
+  if (num_threads == 0) {
+    const char *variable = getenv("CV_NUM_THREADS");
+    if (variable != nullptr && atoi(variable) > 0)
+      num_threads = atoi(variable);
+    else
+      num_threads = max(1u, thread::hardware_concurrency());
+  }
+  for (size_t w = 0; w < num_threads; ++w)
+    workers_.emplace_back(&ThreadPool::Work, this, w);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (thread &worker : workers_) worker.join();
+}
+
+size_t ThreadPool::ForEach(size_t count,
+			   const function<bool(size_t, size_t)> &task) {
+  if (count == 0) return 0;
+  unique_lock<mutex> lock(mutex_);
+  task_ = &task;
+  count_ = count;
+  next_ = 0;
+  failures_ = 0;
+  busy_workers_ = workers_.size();
+  ++generation_;
+  work_ready_.notify_all();
+  work_done_.wait(lock, [this] { return busy_workers_ == 0; });
+  task_ = nullptr;
+  return failures_;
+}
+
+void ThreadPool::Work(size_t worker) {
+  size_t seen_generation = 0;
+  unique_lock<mutex> lock(mutex_);
+  while (true) {
+    work_ready_.wait(lock, [&] {
+      return stopping_ || generation_ != seen_generation;
+    });
+    if (stopping_) return;
+    seen_generation = generation_;
+    // Take indices one at a time, so that a slow file does not hold up
+    // the ones behind it.
+    while (next_ < count_) {
+      const size_t i = next_++;
+      lock.unlock();
+      const bool succeeded = (*task_)(i, worker);
+      lock.lock();
+      if (!succeeded) ++failures_;
+    }
+    if (--busy_workers_ == 0) work_done_.notify_one();
+  }
+}
+
+bool BatchInput::Open(const string &argument) {
+  files_.clear();
+  files_by_stem_.clear();
+  is_batch_ = IsBatchArgument(argument);
+  if (!is_batch_) {
+    files_.push_back(argument);
+    return true;
+  }
+  if (argument[0] == '@') {
+    ifstream list(argument.substr(1));
+    if (!list) {
+      cout << "BatchInput: Cannot open list " << argument.substr(1) << endl;
+      return false;
+    }
+    string filename;
+    while (getline(list, filename))
+      if (!filename.empty()) files_.push_back(filename);
+  } else {
+    DIR *directory = opendir(argument.c_str());
+    if (directory == nullptr) {
+      cout << "BatchInput: Cannot open directory " << argument << endl;
+      return false;
+    }
+    while (const dirent *entry = readdir(directory)) {
+      const string name = entry->d_name;
+      if (name.empty() || name[0] == '.') continue;
+      const string filename = argument + "/" + name;
+      struct stat status;
+      if (stat(filename.c_str(), &status) == 0 && S_ISREG(status.st_mode))
+	files_.push_back(filename);
+    }
+    closedir(directory);
+    sort(files_.begin(), files_.end());
+  }
+  // The outputs of a batch are named after the stems of its files, so
+  // two files with the same stem would overwrite each other's outputs.
+  for (const string &file : files_) {
+    if (!files_by_stem_.emplace(Stem(file), file).second) {
+      cout << "BatchInput: Duplicate name " << Stem(file) << " in "
+	   << argument << endl;
+      files_.clear();
+      files_by_stem_.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BatchInput::Find(const string &stem, string *filename) const {
+  if (filename == nullptr) abort();
+  if (!is_batch_) {
+    *filename = files_[0];
+    return true;
+  }
+  const auto file = files_by_stem_.find(stem);
+  if (file == files_by_stem_.end()) return false;
+  *filename = file->second;
+  return true;
+}
+
+size_t ProcessBatch(ThreadPool *pool, const BatchInput &inputs,
+		    const function<bool(size_t, size_t)> &process) {
+  if (pool == nullptr) abort();
+  const vector<string> &files = inputs.files();
+  // Written by one worker each, read once all of them are done.
+  vector<char> failed(files.size(), 0);
+  const size_t failures = pool->ForEach(files.size(),
+    [&](size_t i, size_t worker) {
+      failed[i] = !process(i, worker);
+      return !failed[i];
+    });
+  for (size_t i = 0; i < files.size(); ++i)
+    if (failed[i]) cout << "Can't process file " << files[i] << endl;
+  return failures;
+}
+
+bool IsBatchArgument(const string &argument) {
+  if (!argument.empty() && argument[0] == '@') return true;
+  struct stat status;
+  return stat(argument.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+string Stem(const string &filename) {
+  const size_t slash = filename.find_last_of('/');
+  const string name =
+    (slash == string::npos) ? filename : filename.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  return (dot == string::npos || dot == 0) ? name : name.substr(0, dot);
+}
+
+string OutputFilename(const string &directory, const string &stem,
+		      const string &extension) {
+  return directory + "/" + stem + extension;
+}
+
+bool ParseCount(const string &argument, size_t *count) {
+  if (count == nullptr) abort();
+  char *end;
+  errno = 0;
+  const long value = strtol(argument.c_str(), &end, 10);
+  if (argument.empty() || *end != '\0' || errno != 0 || value <= 0)
+    return false;
+  *count = value;
+  return true;
+}
+
+bool MakeDirectory(const string &directory) {
+  if (mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST) return true;
+  cout << "MakeDirectory: Cannot create " << directory << endl;
+  return false;
+}
+
+}  // namespace ComputerVisionProjects
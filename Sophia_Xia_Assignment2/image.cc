@@ -1,55 +1,311 @@
 // Sophia Xia
-// I did not modify or add any code in this file
+// Extended from the version of this file provided for the class.
 
 // Class for representing a 2D gray-scale image,
 // with support for reading/writing pgm images.
 // To be used in Computer Vision class.
 
 #include "image.h"
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 namespace ComputerVisionProjects {
 
-Image::Image(const Image &an_image){
-  AllocateSpaceAndSetSize(an_image.num_rows(), an_image.num_columns());
+template <typename PixelType>
+Image<PixelType>::Image(const Image &an_image): Image() {
+  *this = an_image;
+}
+
+template <typename PixelType>
+Image<PixelType> &Image<PixelType>::operator=(const Image &an_image) {
+  if (this == &an_image) return *this;
+  SetSize(an_image.num_rows(), an_image.num_columns());
   SetNumberGrayLevels(an_image.num_gray_levels());
 
-  for (size_t i = 0; i < num_rows(); ++i)
-    for (size_t j = 0; j < num_columns(); ++j){
-      SetPixel(i,j, an_image.GetPixel(i,j));
-    }
+  // Both images share the same stride, so the whole buffer (padding
+  // included) can be copied at once.
+  if (pixels_ != nullptr)
+    memcpy(pixels_, an_image.pixels_,
+	   num_rows_ * stride_ * sizeof(PixelType));
+  return *this;
+}
+
+template <typename PixelType>
+Image<PixelType>::Image(Image &&an_image) noexcept : Image() {
+  *this = std::move(an_image);
 }
 
-Image::~Image(){
+template <typename PixelType>
+Image<PixelType> &Image<PixelType>::operator=(Image &&an_image) noexcept {
+  if (this == &an_image) return *this;
   DeallocateSpace();
+  num_rows_ = an_image.num_rows_;
+  num_columns_ = an_image.num_columns_;
+  stride_ = an_image.stride_;
+  capacity_ = an_image.capacity_;
+  num_gray_levels_ = an_image.num_gray_levels_;
+  huge_pages_ = an_image.huge_pages_;
+  pixels_ = an_image.pixels_;
+
+  an_image.pixels_ = nullptr;
+  an_image.DeallocateSpace();
+  an_image.num_gray_levels_ = 0;
+  return *this;
 }
 
-void Image::AllocateSpaceAndSetSize(size_t num_rows, size_t num_columns) {
-  if (pixels_ != nullptr) DeallocateSpace();
-  pixels_ = new int*[num_rows];
-  for (size_t i = 0; i < num_rows; ++i)
-    pixels_[i] = new int[num_columns];
+template <typename PixelType>
+Image<PixelType>::~Image(){
+  DeallocateSpace();
+}
+
+template <typename PixelType>
+void Image<PixelType>::AllocateSpaceAndSetSize(size_t num_rows,
+					       size_t num_columns) {
+  SetSize(num_rows, num_columns);
+  if (pixels_ != nullptr)
+    memset(pixels_, 0, num_rows_ * stride_ * sizeof(PixelType));
+}
+
+template <typename PixelType>
+void Image<PixelType>::SetSize(size_t num_rows, size_t num_columns) {
+  // Round every row up to a whole number of cache lines.
+  const size_t pixels_per_line = kCacheLineSize / sizeof(PixelType);
+  const size_t stride =
+    (num_columns + pixels_per_line - 1) / pixels_per_line * pixels_per_line;
+  const size_t num_pixels = num_rows * stride;
+
+  // Only go back to the allocator when the current buffer is too small.
+  if (num_pixels > capacity_) {
+    DeallocateSpace();
+    size_t size = num_pixels * sizeof(PixelType);
+    size_t alignment = kCacheLineSize;
+    const bool huge_pages = huge_pages_ && size >= kHugePageSize;
+    if (huge_pages) {
+      // Whole, aligned huge pages, so that none of them is shared with
+      // other allocations.
+      alignment = kHugePageSize;
+      size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, size) != 0) abort();
+#ifdef MADV_HUGEPAGE
+    // Only advice: without transparent huge pages the buffer simply
+    // stays on regular pages.
+    if (huge_pages) madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+    pixels_ = static_cast<PixelType *>(buffer);
+    capacity_ = size / sizeof(PixelType);
+  }
 
   num_rows_ = num_rows;
   num_columns_ = num_columns;
+  stride_ = stride;
 }
 
-void Image::DeallocateSpace() {
-  for (size_t i = 0; i < num_rows_; i++)
-    delete pixels_[i];
-  delete pixels_;
+template <typename PixelType>
+void Image<PixelType>::DeallocateSpace() {
+  free(pixels_);
   pixels_ = nullptr;
   num_rows_ = 0;
   num_columns_ = 0;
+  stride_ = 0;
+  capacity_ = 0;
+}
+
+template <typename PixelType>
+Image<PixelType> ImagePool<PixelType>::Take(size_t num_pixels) {
+  // The smallest buffer that is large enough, otherwise the largest one
+  // (it grows the least).
+  size_t best = images_.size();
+  for (size_t k = 0; k < images_.size(); ++k) {
+    if (best == images_.size()) {
+      best = k;
+      continue;
+    }
+    const size_t capacity = images_[k].capacity();
+    const size_t best_capacity = images_[best].capacity();
+    const bool fits = capacity >= num_pixels;
+    const bool best_fits = best_capacity >= num_pixels;
+    if ((fits && (!best_fits || capacity < best_capacity)) ||
+	(!fits && !best_fits && capacity > best_capacity))
+      best = k;
+  }
+  Image<PixelType> an_image;
+  an_image.UseHugePages(use_huge_pages_);
+  if (best < images_.size()) {
+    an_image = std::move(images_[best]);
+    images_[best] = std::move(images_.back());
+    images_.pop_back();
+  }
+  return an_image;
+}
+
+template <typename PixelType>
+Image<PixelType> ImagePool<PixelType>::Acquire(size_t num_rows,
+					       size_t num_columns) {
+  Image<PixelType> an_image = Take(num_rows * num_columns);
+  an_image.AllocateSpaceAndSetSize(num_rows, num_columns);
+  return an_image;
+}
+
+template <typename PixelType>
+Image<PixelType> ImagePool<PixelType>::Acquire(
+    const Image<PixelType> &an_image) {
+  Image<PixelType> copy = Take(an_image.num_rows() * an_image.num_columns());
+  copy = an_image;
+  return copy;
 }
 
-bool ReadImage(const string &filename, Image *an_image) {  
+template <typename PixelType>
+void ImagePool<PixelType>::Release(Image<PixelType> *an_image) {
+  if (an_image == nullptr) abort();
+  if (an_image->capacity() == 0) return;
+  images_.push_back(std::move(*an_image));
+}
+
+ImageView<const uint8_t> ObjectRegion(ImageView<const uint8_t> first,
+				      ImageView<const uint8_t> second,
+				      int threshold) {
+  if (first.num_rows() != second.num_rows() ||
+      first.num_columns() != second.num_columns()) abort();
+  size_t first_row = first.num_rows();
+  size_t first_column = first.num_columns();
+  size_t last_row = 0;
+  size_t last_column = 0;
+  for (size_t i = 0; i < first.num_rows(); ++i) {
+    const uint8_t *first_pixels = first.row(i);
+    const uint8_t *second_pixels = second.row(i);
+    for (size_t j = 0; j < first.num_columns(); ++j) {
+      if (first_pixels[j] > threshold && second_pixels[j] > threshold) {
+	if (first_row == first.num_rows()) first_row = i;
+	last_row = i;
+	first_column = min(first_column, j);
+	last_column = max(last_column, j);
+      }
+    }
+  }
+  if (first_row == first.num_rows()) return first.view(0, 0, 0, 0);
+  return first.view(first_row, first_column, last_row - first_row + 1,
+		    last_column - first_column + 1);
+}
+
+namespace {
+
+// Largest gray level a pgm file can store; files with more than
+// kMaxByteGrayLevels levels use two bytes per pixel.
+const size_t kMaxByteGrayLevels = 255;
+const size_t kMaxPgmGrayLevels = 65535;
+
+// Skips whitespace and comments (from '#' to the end of the line)
+// in a pgm header, then reads one decimal field into value.
+// Returns false if no field could be read.
+bool ReadHeaderField(FILE *input, size_t *value) {
+  int c = fgetc(input);
+  while (c == '#' || isspace(c)) {
+    if (c == '#')
+      while (c != '\n' && c != EOF) c = fgetc(input);
+    c = fgetc(input);
+  }
+  if (!isdigit(c)) return false;
+  *value = 0;
+  while (isdigit(c)) {
+    *value = *value * 10 + (c - '0');
+    c = fgetc(input);
+  }
+  // Exactly one whitespace character ends the field; after the last
+  // field it is the one separating the header from the pixels.
+  return isspace(c);
+}
+
+// Reads the header of a binary (P5) pgm file. On success the file is
+// positioned at the first pixel.
+bool ReadPgmHeader(FILE *input, size_t *num_rows, size_t *num_columns,
+		   size_t *num_gray_levels) {
+  // Check for the right "magic number".
+  if (fgetc(input) != 'P' || fgetc(input) != '5') return false;
+  return ReadHeaderField(input, num_columns) &&
+    ReadHeaderField(input, num_rows) &&
+    ReadHeaderField(input, num_gray_levels) &&
+    *num_gray_levels > 0 && *num_gray_levels <= kMaxPgmGrayLevels;
+}
+
+// Writes the header of a binary (P5) pgm file.
+void WritePgmHeader(FILE *output, size_t num_rows, size_t num_columns,
+		    size_t num_gray_levels) {
+  fprintf(output, "P5\n"); // Magic number.
+  fprintf(output, "#\n");  // Empty comment.
+  fprintf(output, "%d %d\n%03d\n", static_cast<int>(num_columns),
+	  static_cast<int>(num_rows), static_cast<int>(num_gray_levels));
+}
+
+// Converts one row of a pgm file to pixels.
+template <typename PixelType>
+void BytesToPixels(const unsigned char *bytes, size_t bytes_per_pixel,
+		   size_t num_columns, PixelType *pixels) {
+  if (bytes_per_pixel == 1) {
+    for (size_t j = 0; j < num_columns; ++j)
+      pixels[j] = bytes[j];
+  } else {
+    // 16-bit pixels are stored most significant byte first.
+    for (size_t j = 0; j < num_columns; ++j)
+      pixels[j] = (bytes[2 * j] << 8) | bytes[2 * j + 1];
+  }
+}
+
+// Converts one row of pixels to the bytes of a pgm file.
+template <typename PixelType>
+void PixelsToBytes(const PixelType *pixels, size_t num_columns,
+		   size_t bytes_per_pixel, unsigned char *bytes) {
+  if (bytes_per_pixel == 1) {
+    for (size_t j = 0; j < num_columns; ++j)
+      bytes[j] = static_cast<unsigned char>(static_cast<int>(pixels[j]));
+  } else {
+    for (size_t j = 0; j < num_columns; ++j) {
+      const long pixel = static_cast<long>(pixels[j]);
+      const unsigned int value =
+	pixel < 0 ? 0 : min<long>(pixel, kMaxPgmGrayLevels);
+      bytes[2 * j] = value >> 8;
+      bytes[2 * j + 1] = value & 0xff;
+    }
+  }
+}
+
+// Magic number of label images.
+const char kLabelMagic[] = "L32";
+
+// Returns true if filename ends with extension.
+bool HasExtension(const string &filename, const string &extension) {
+  return filename.size() >= extension.size() &&
+    filename.compare(filename.size() - extension.size(), extension.size(),
+		     extension) == 0;
+}
+
+// Reverses the order of the bits of a byte.
+unsigned char ReverseBits(unsigned char byte) {
+  byte = (byte & 0xf0) >> 4 | (byte & 0x0f) << 4;
+  byte = (byte & 0xcc) >> 2 | (byte & 0x33) << 2;
+  return (byte & 0xaa) >> 1 | (byte & 0x55) << 1;
+}
+
+}  // namespace
+
+template <typename PixelType>
+bool ReadImage(const string &filename, Image<PixelType> *an_image) {  
   if (an_image == nullptr) abort();
   FILE *input = fopen(filename.c_str(),"rb");
   if (input == 0) {
@@ -57,228 +313,935 @@ bool ReadImage(const string &filename, Image *an_image) {
     return false;
   }
   
-  // Check for the right "magic number".
-  char line[1024];
-  if (fread(line, 1, 3, input) != 3 || strncmp(line,"P5\n",3)) {
+  size_t num_rows, num_columns, levels;
+  if (!ReadPgmHeader(input, &num_rows, &num_columns, &levels)) {
     fclose(input);
     cout << "ReadImage: Expected .pgm file" << endl;
     return false;
   }
-  
-  // Skip comments.
-  do
-    fgets(line, sizeof line, input);
-  while(*line == '#');
-  
-  // Read the width and height.
-  int num_columns,num_rows;
-  sscanf(line,"%d %d\n", &num_columns, &num_rows);
-  an_image->AllocateSpaceAndSetSize(num_rows, num_columns);
-  
+  if (levels > static_cast<double>(numeric_limits<PixelType>::max())) {
+    fclose(input);
+    cout << "ReadImage: Too many gray levels for the image type" << endl;
+    return false;
+  }
 
-  // Read # of gray levels.
-  fgets(line, sizeof line, input);
-  int levels;
-  sscanf(line,"%d\n", &levels);
+  // Read all the pixels with a single call.
+  const size_t bytes_per_pixel = (levels > kMaxByteGrayLevels) ? 2 : 1;
+  vector<unsigned char> bytes(num_rows * num_columns * bytes_per_pixel);
+  if (fread(bytes.data(), 1, bytes.size(), input) != bytes.size()) {
+    fclose(input);
+    cout << "ReadImage: short file" << endl;
+    return false;
+  }
+  fclose(input);
+
+  an_image->AllocateSpaceAndSetSize(num_rows, num_columns);
   an_image->SetNumberGrayLevels(levels);
+  for (size_t i = 0; i < num_rows; ++i)
+    BytesToPixels(bytes.data() + i * num_columns * bytes_per_pixel,
+		  bytes_per_pixel, num_columns, an_image->row(i));
+  return true; 
+}
 
-  // read pixel row by row.
-  for (int i = 0; i < num_rows; ++i) {
-    for (int j = 0;j < num_columns; ++j) {
-      const int byte=fgetc(input);
-      if (byte == EOF) {
-        fclose(input);
-        cout << "ReadImage: short file" << endl;
-        return false;
-      }
-      an_image->SetPixel(i, j, byte);
-    }
+bool ReadImageHeader(const string &filename, size_t *num_rows,
+		     size_t *num_columns, size_t *num_gray_levels) {
+  if (num_rows == nullptr || num_columns == nullptr ||
+      num_gray_levels == nullptr) abort();
+  FILE *input = fopen(filename.c_str(), "rb");
+  if (input == 0) {
+    cout << "ReadImageHeader: Cannot open file" << endl;
+    return false;
   }
-  
+  const bool read = ReadPgmHeader(input, num_rows, num_columns,
+				  num_gray_levels);
   fclose(input);
-  return true; 
+  if (!read) cout << "ReadImageHeader: Expected .pgm file" << endl;
+  return read;
 }
 
-bool WriteImage(const string &filename, const Image &an_image) {  
-  FILE *output = fopen(filename.c_str(), "w");
+template <typename PixelType>
+bool WriteImage(const string &filename, const Image<PixelType> &an_image) {  
+  FILE *output = fopen(filename.c_str(), "wb");
   if (output == 0) {
     cout << "WriteImage: cannot open file" << endl;
     return false;
   }
   const int num_rows = an_image.num_rows();
   const int num_columns = an_image.num_columns();
-  const int colors = an_image.num_gray_levels();
+  const size_t colors = min(an_image.num_gray_levels(), kMaxPgmGrayLevels);
 
-  // Write the header.
-  fprintf(output, "P5\n"); // Magic number.
+  WritePgmHeader(output, num_rows, num_columns, colors);
+
+  // Convert the pixels to bytes, then write them with a single call.
+  const size_t bytes_per_pixel = (colors > kMaxByteGrayLevels) ? 2 : 1;
+  vector<unsigned char> bytes(static_cast<size_t>(num_rows) * num_columns *
+			      bytes_per_pixel);
+  for (int i = 0; i < num_rows; ++i)
+    PixelsToBytes(an_image.row(i), num_columns, bytes_per_pixel,
+		  bytes.data() + i * num_columns * bytes_per_pixel);
+  if (fwrite(bytes.data(), 1, bytes.size(), output) != bytes.size()) {
+    fclose(output);
+    cout << "WriteImage: could not write" << endl;
+    return false;
+  }
+
+  fclose(output);
+  return true; 
+}
+
+bool ReadLabelImage(const string &input_filename, Image<int32_t> *labels) {
+  if (labels == nullptr) abort();
+  FILE *input = fopen(input_filename.c_str(), "rb");
+  if (input == 0) {
+    cout << "ReadLabelImage: Cannot open file" << endl;
+    return false;
+  }
+  size_t num_rows, num_columns, largest_label;
+  bool magic = true;
+  for (const char *c = kLabelMagic; *c != '\0'; ++c)
+    magic = magic && fgetc(input) == *c;
+  if (!magic || !ReadHeaderField(input, &num_columns) ||
+      !ReadHeaderField(input, &num_rows) ||
+      !ReadHeaderField(input, &largest_label)) {
+    fclose(input);
+    cout << "ReadLabelImage: Expected .lbl file" << endl;
+    return false;
+  }
+
+  // Read all the pixels with a single call.
+  vector<unsigned char> bytes(num_rows * num_columns * sizeof(int32_t));
+  const size_t bytes_read = fread(bytes.data(), 1, bytes.size(), input);
+  fclose(input);
+  if (bytes_read != bytes.size()) {
+    cout << "ReadLabelImage: short file" << endl;
+    return false;
+  }
+
+  labels->AllocateSpaceAndSetSize(num_rows, num_columns);
+  labels->SetNumberGrayLevels(largest_label);
+  const unsigned char *source = bytes.data();
+  for (size_t i = 0; i < num_rows; ++i) {
+    int32_t *pixels = labels->row(i);
+    for (size_t j = 0; j < num_columns; ++j, source += 4)
+      pixels[j] = static_cast<int32_t>(uint32_t{source[0]} << 24 |
+				       uint32_t{source[1]} << 16 |
+				       uint32_t{source[2]} << 8 | source[3]);
+  }
+  return true;
+}
+
+bool WriteLabelImage(const string &output_filename,
+		     const Image<int32_t> &labels) {
+  FILE *output = fopen(output_filename.c_str(), "wb");
+  if (output == 0) {
+    cout << "WriteLabelImage: cannot open file" << endl;
+    return false;
+  }
+  const size_t num_rows = labels.num_rows();
+  const size_t num_columns = labels.num_columns();
+  fprintf(output, "%s\n", kLabelMagic);
   fprintf(output, "#\n");  // Empty comment.
-  fprintf(output, "%d %d\n%03d\n", num_columns, num_rows, colors);
-
-  for (int i = 0; i < num_rows; ++i) {
-    for (int j = 0; j < num_columns; ++j) {
-      const int byte = an_image.GetPixel(i , j);
-      if (fputc(byte,output) == EOF) {
-	    fclose(output);
-            cout << "WriteImage: could not write" << endl;
-	    return false;
-      }
+  fprintf(output, "%zu %zu\n%zu\n", num_columns, num_rows,
+	  labels.num_gray_levels());
+
+  // Convert the labels to bytes, then write them with a single call.
+  vector<unsigned char> bytes(num_rows * num_columns * sizeof(int32_t));
+  unsigned char *destination = bytes.data();
+  for (size_t i = 0; i < num_rows; ++i) {
+    const int32_t *pixels = labels.row(i);
+    for (size_t j = 0; j < num_columns; ++j, destination += 4) {
+      const uint32_t value = static_cast<uint32_t>(pixels[j]);
+      destination[0] = value >> 24;
+      destination[1] = (value >> 16) & 0xff;
+      destination[2] = (value >> 8) & 0xff;
+      destination[3] = value & 0xff;
     }
   }
+  const bool written =
+    fwrite(bytes.data(), 1, bytes.size(), output) == bytes.size();
+  fclose(output);
+  if (!written) cout << "WriteLabelImage: could not write" << endl;
+  return written;
+}
+
+bool IsLabelFilename(const string &filename) {
+  return HasExtension(filename, ".lbl");
+}
+
+bool WriteLabelPreview(const string &output_filename,
+		       const Image<int32_t> &labels) {
+  FILE *output = fopen(output_filename.c_str(), "wb");
+  if (output == 0) {
+    cout << "WriteLabelPreview: cannot open file" << endl;
+    return false;
+  }
+  const size_t num_rows = labels.num_rows();
+  const size_t num_columns = labels.num_columns();
+  fprintf(output, "P6\n"); // Magic number.
+  fprintf(output, "#\n");  // Empty comment.
+  fprintf(output, "%zu %zu\n255\n", num_columns, num_rows);
 
+  vector<unsigned char> bytes(num_rows * num_columns * 3);
+  unsigned char *destination = bytes.data();
+  for (size_t i = 0; i < num_rows; ++i) {
+    const int32_t *pixels = labels.row(i);
+    for (size_t j = 0; j < num_columns; ++j, destination += 3) {
+      if (pixels[j] == 0) {
+	destination[0] = destination[1] = destination[2] = 0;
+	continue;
+      }
+      // Multiplicative hashing spreads consecutive labels far apart; the
+      // top bit of every channel is set so that no label looks black.
+      const uint32_t hash = static_cast<uint32_t>(pixels[j]) * 2654435761u;
+      destination[0] = (hash >> 24) | 0x80;
+      destination[1] = ((hash >> 16) & 0xff) | 0x80;
+      destination[2] = ((hash >> 8) & 0xff) | 0x80;
+    }
+  }
+  const bool written =
+    fwrite(bytes.data(), 1, bytes.size(), output) == bytes.size();
   fclose(output);
-  return true; 
+  if (!written) cout << "WriteLabelPreview: could not write" << endl;
+  return written;
 }
 
-// Implements the Bresenham's incremental midpoint algorithm;
-// (adapted from J.D.Foley, A. van Dam, S.K.Feiner, J.F.Hughes
-// "Computer Graphics. Principles and practice", 
-// 2nd ed., 1990, section 3.2.2);  
-void DrawLine(int x0, int y0, int x1, int y1, int color,
-	      Image *an_image) {  
-  if (an_image == nullptr) abort();
+PgmBandReader::~PgmBandReader() {
+  if (input_ != nullptr) fclose(input_);
+}
+
+bool PgmBandReader::Open(const string &filename) {
+  if (input_ != nullptr) fclose(input_);
+  input_ = fopen(filename.c_str(), "rb");
+  if (input_ == 0) {
+    cout << "PgmBandReader: Cannot open file" << endl;
+    return false;
+  }
+  if (!ReadPgmHeader(input_, &num_rows_, &num_columns_, &num_gray_levels_)) {
+    fclose(input_);
+    input_ = nullptr;
+    cout << "PgmBandReader: Expected .pgm file" << endl;
+    return false;
+  }
+  bytes_per_pixel_ = (num_gray_levels_ > kMaxByteGrayLevels) ? 2 : 1;
+  next_row_ = 0;
+  window_first_row_ = 0;
+  window_.clear();
+  first_row_ = 0;
+  band_rows_ = 0;
+  halo_above_ = 0;
+  return true;
+}
+
+template <typename PixelType>
+bool PgmBandReader::ReadBand(size_t band_rows, size_t halo,
+			     Image<PixelType> *band) {
+  if (band == nullptr) abort();
+  if (input_ == nullptr || next_row_ >= num_rows_ || band_rows == 0)
+    return false;
+  if (num_gray_levels_ >
+      static_cast<double>(numeric_limits<PixelType>::max())) {
+    cout << "PgmBandReader: Too many gray levels for the image type" << endl;
+    return false;
+  }
+  const size_t row_bytes = num_columns_ * bytes_per_pixel_;
+  const size_t first_row = next_row_;
+  const size_t last_row = min(first_row + band_rows, num_rows_);
+  // Rows [top, bottom) are needed: the band plus its halo.
+  const size_t top = first_row - min(halo, first_row);
+  const size_t bottom = min(last_row + halo, num_rows_);
+
+  // Drop the rows of the window above the new top, keeping the rest
+  // (the halo shared with the previous band), then read the rows that
+  // are still missing.
+  const size_t window_rows = window_.size() / row_bytes;
+  const size_t dropped_rows = min(top - window_first_row_, window_rows);
+  window_.erase(window_.begin(), window_.begin() + dropped_rows * row_bytes);
+  window_first_row_ += dropped_rows;
+  const size_t kept_rows = window_rows - dropped_rows;
+  const size_t missing_rows = bottom - window_first_row_ - kept_rows;
+  window_.resize((kept_rows + missing_rows) * row_bytes);
+  if (fread(window_.data() + kept_rows * row_bytes, 1,
+	    missing_rows * row_bytes, input_) != missing_rows * row_bytes) {
+    cout << "PgmBandReader: short file" << endl;
+    return false;
+  }
+
+  band->AllocateSpaceAndSetSize(bottom - top, num_columns_);
+  band->SetNumberGrayLevels(num_gray_levels_);
+  for (size_t i = top; i < bottom; ++i)
+    BytesToPixels(window_.data() + (i - window_first_row_) * row_bytes,
+		  bytes_per_pixel_, num_columns_, band->row(i - top));
+
+  first_row_ = first_row;
+  band_rows_ = last_row - first_row;
+  halo_above_ = first_row - top;
+  next_row_ = last_row;
+  return true;
+}
+
+PgmBandWriter::~PgmBandWriter() {
+  if (output_ != nullptr) fclose(output_);
+}
+
+bool PgmBandWriter::Open(const string &filename, size_t num_rows,
+			 size_t num_columns, size_t num_gray_levels) {
+  if (output_ != nullptr) fclose(output_);
+  output_ = fopen(filename.c_str(), "wb");
+  if (output_ == 0) {
+    cout << "PgmBandWriter: cannot open file" << endl;
+    return false;
+  }
+  num_rows_ = num_rows;
+  num_columns_ = num_columns;
+  const size_t colors = min(num_gray_levels, kMaxPgmGrayLevels);
+  bytes_per_pixel_ = (colors > kMaxByteGrayLevels) ? 2 : 1;
+  rows_written_ = 0;
+  WritePgmHeader(output_, num_rows, num_columns, colors);
+  return true;
+}
+
+template <typename PixelType>
+bool PgmBandWriter::WriteRows(const Image<PixelType> &band,
+			      size_t first_band_row, size_t num_rows) {
+  if (output_ == nullptr || band.num_columns() != num_columns_ ||
+      first_band_row + num_rows > band.num_rows() ||
+      rows_written_ + num_rows > num_rows_) {
+    cout << "PgmBandWriter: rows do not fit the image" << endl;
+    return false;
+  }
+  const size_t row_bytes = num_columns_ * bytes_per_pixel_;
+  bytes_.resize(num_rows * row_bytes);
+  for (size_t i = 0; i < num_rows; ++i)
+    PixelsToBytes(band.row(first_band_row + i), num_columns_,
+		  bytes_per_pixel_, bytes_.data() + i * row_bytes);
+  if (fwrite(bytes_.data(), 1, bytes_.size(), output_) != bytes_.size()) {
+    cout << "PgmBandWriter: could not write" << endl;
+    return false;
+  }
+  rows_written_ += num_rows;
+  return true;
+}
+
+bool PgmBandWriter::Close() {
+  if (output_ == nullptr) return false;
+  const bool complete = (rows_written_ == num_rows_);
+  const bool closed = (fclose(output_) == 0);
+  output_ = nullptr;
+  if (!complete) cout << "PgmBandWriter: image is missing rows" << endl;
+  return complete && closed;
+}
+
+void BinaryImage::AllocateSpaceAndSetSize(size_t num_rows,
+					  size_t num_columns) {
+  num_rows_ = num_rows;
+  num_columns_ = num_columns;
+  words_per_row_ = (num_columns + kBitsPerWord - 1) / kBitsPerWord;
+  words_.assign(num_rows * words_per_row_, 0);
+}
+
+size_t BinaryImage::NextForeground(size_t i, size_t j) const {
+  if (j >= num_columns_) return num_columns_;
+  const uint64_t *words = row(i);
+  size_t k = j / kBitsPerWord;
+  // Ignore the pixels of the first word before column j.
+  uint64_t word = words[k] & (~uint64_t{0} << (j % kBitsPerWord));
+  while (word == 0) {
+    if (++k == words_per_row_) return num_columns_;
+    word = words[k];
+  }
+  return k * kBitsPerWord + __builtin_ctzll(word);
+}
 
-#ifdef SWAP
-#undef SWAP
+size_t BinaryImage::NextBackground(size_t i, size_t j) const {
+  if (j >= num_columns_) return num_columns_;
+  const uint64_t *words = row(i);
+  size_t k = j / kBitsPerWord;
+  // Ignore the pixels of the first word before column j.
+  uint64_t word = ~words[k] & (~uint64_t{0} << (j % kBitsPerWord));
+  while (word == 0) {
+    if (++k == words_per_row_) return num_columns_;
+    word = ~words[k];
+  }
+  // The padding bits past the last column read as background.
+  return min(k * kBitsPerWord + __builtin_ctzll(word), num_columns_);
+}
+
+size_t BinaryImage::CountForeground() const {
+  size_t count = 0;
+  for (const uint64_t word : words_) count += __builtin_popcountll(word);
+  return count;
+}
+
+namespace {
+
+// The value of the pixels above threshold.
+const int kWhite = 255;
+
+// Returns the count (at most 64) pixels above threshold as the bits of a
+// BinaryImage word.
+template <typename PixelType>
+uint64_t ThresholdWord(const PixelType *pixels, size_t count, int threshold) {
+  uint64_t word = 0;
+  for (size_t b = 0; b < count; ++b)
+    word |= uint64_t{threshold < pixels[b]} << b;
+  return word;
+}
+
+// Same, with the bits of full words taken from the sign masks of vector
+// byte compares.
+uint64_t ThresholdWord(const uint8_t *pixels, size_t count, int threshold) {
+#if defined(__SSE2__)
+  // Above threshold is at least threshold + 1, which has to be a byte.
+  if (count == BinaryImage::kBitsPerWord && threshold >= 0 &&
+      threshold < kWhite) {
+    uint64_t word = 0;
+#if defined(__AVX2__)
+    const __m256i above = _mm256_set1_epi8(static_cast<char>(threshold + 1));
+    for (size_t b = 0; b < count; b += 32) {
+      const __m256i block =
+	_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + b));
+      const __m256i mask =
+	_mm256_cmpeq_epi8(_mm256_max_epu8(block, above), block);
+      word |= uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(mask))} << b;
+    }
+#else
+    const __m128i above = _mm_set1_epi8(static_cast<char>(threshold + 1));
+    for (size_t b = 0; b < count; b += 16) {
+      const __m128i block =
+	_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + b));
+      const __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(block, above), block);
+      word |= uint64_t{static_cast<uint16_t>(_mm_movemask_epi8(mask))} << b;
+    }
+#endif
+    return word;
+  }
 #endif
-#define SWAP(a,b) {a^=b; b^=a; a^=b;}
+  return ThresholdWord<uint8_t>(pixels, count, threshold);
+}
 
-  const int DIR_X = 0;
-  const int DIR_Y = 1;
-  
-  // Increments: East, North-East, South, South-East, North.
-  int incrE,
-    incrNE,
-    incrS,
-    incrSE,
-    incrN;     
-  int d;         /* the D */
-  int x,y;       /* running coordinates */
-  int mpCase;    /* midpoint algorithm's case */
-  int done;      /* set to 1 when done */
-  
-  int xmin = x0;
-  int xmax = x1;
-  int ymin = y0;
-  int ymax = y1;
-  
-  int dx = xmax - xmin;
-  int dy = ymax - ymin;
-  int dir;
-
-  if (dx * dx > dy * dy) {  // Horizontal scan.
-    dir=DIR_X;
-    if (xmax < xmin) {
-      SWAP(xmin, xmax);
-      SWAP(ymin , ymax);
-    } 
-    dx = xmax - xmin;
-    dy = ymax - ymin;
-
-    if (dy >= 0) {
-      mpCase = 1;
-      d = 2 * dy - dx;      
-    } else {
-      mpCase = 2;
-      d = 2 * dy + dx;      
+}  // namespace
+
+template <typename PixelType>
+void ThresholdToBinary(const Image<PixelType> &an_image, int threshold,
+		       BinaryImage *binary_image) {
+  if (binary_image == nullptr) abort();
+  const size_t num_rows = an_image.num_rows();
+  const size_t num_columns = an_image.num_columns();
+  const size_t kBitsPerWord = BinaryImage::kBitsPerWord;
+  binary_image->AllocateSpaceAndSetSize(num_rows, num_columns);
+  for (size_t i = 0; i < num_rows; ++i) {
+    const PixelType *pixels = an_image.row(i);
+    uint64_t *words = binary_image->row(i);
+    for (size_t k = 0; k < binary_image->words_per_row(); ++k) {
+      const size_t first = k * kBitsPerWord;
+      const size_t count = min(kBitsPerWord, num_columns - first);
+      words[k] = ThresholdWord(pixels + first, count, threshold);
     }
+  }
+}
+
+void ThresholdPixels(uint8_t *pixels, size_t count, int threshold) {
+  // Every byte is above a negative threshold and none is above 255.
+  if (threshold < 0 || threshold >= kWhite) {
+    memset(pixels, threshold < 0 ? kWhite : 0, count);
+    return;
+  }
+  // A byte is above threshold if it is the maximum of itself and
+  // threshold + 1, and the all-ones mask of that compare is 255.
+  size_t j = 0;
+#if defined(__AVX2__)
+  const __m256i above = _mm256_set1_epi8(static_cast<char>(threshold + 1));
+  for (; j + 32 <= count; j += 32) {
+    __m256i *block = reinterpret_cast<__m256i *>(pixels + j);
+    const __m256i value = _mm256_loadu_si256(block);
+    _mm256_storeu_si256(block,
+			_mm256_cmpeq_epi8(_mm256_max_epu8(value, above), value));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i above_16 = _mm_set1_epi8(static_cast<char>(threshold + 1));
+  for (; j + 16 <= count; j += 16) {
+    __m128i *block = reinterpret_cast<__m128i *>(pixels + j);
+    const __m128i value = _mm_loadu_si128(block);
+    _mm_storeu_si128(block,
+		     _mm_cmpeq_epi8(_mm_max_epu8(value, above_16), value));
+  }
+#endif
+  for (; j < count; ++j)
+    pixels[j] = (threshold < pixels[j]) ? kWhite : 0;
+}
 
-    incrNE = 2 * (dy - dx);
-    incrE = 2 * dy;
-    incrSE = 2 * (dy + dx);
-  } else {// vertical scan.
-    dir = DIR_Y;
-    if (ymax < ymin) {
-      SWAP(xmin, xmax);
-      SWAP(ymin, ymax);
+void ThresholdPixels(int32_t *pixels, size_t count, int threshold) {
+  // The all-ones mask of the compare is masked down to 255.
+  size_t j = 0;
+#if defined(__AVX2__)
+  const __m256i limit = _mm256_set1_epi32(threshold);
+  const __m256i white = _mm256_set1_epi32(kWhite);
+  for (; j + 8 <= count; j += 8) {
+    __m256i *block = reinterpret_cast<__m256i *>(pixels + j);
+    const __m256i value = _mm256_loadu_si256(block);
+    _mm256_storeu_si256(block,
+			_mm256_and_si256(_mm256_cmpgt_epi32(value, limit), white));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i limit_4 = _mm_set1_epi32(threshold);
+  const __m128i white_4 = _mm_set1_epi32(kWhite);
+  for (; j + 4 <= count; j += 4) {
+    __m128i *block = reinterpret_cast<__m128i *>(pixels + j);
+    const __m128i value = _mm_loadu_si128(block);
+    _mm_storeu_si128(block,
+		     _mm_and_si128(_mm_cmpgt_epi32(value, limit_4), white_4));
+  }
+#endif
+  for (; j < count; ++j)
+    pixels[j] = (threshold < pixels[j]) ? kWhite : 0;
+}
+
+template <typename PixelType>
+void CopyImage(const BinaryImage &binary_image, Image<PixelType> *an_image) {
+  if (an_image == nullptr) abort();
+  const size_t num_rows = binary_image.num_rows();
+  const size_t num_columns = binary_image.num_columns();
+  an_image->AllocateSpaceAndSetSize(num_rows, num_columns);
+  an_image->SetNumberGrayLevels(kMaxByteGrayLevels);
+  for (size_t i = 0; i < num_rows; ++i) {
+    PixelType *pixels = an_image->row(i);
+    for (size_t j = binary_image.NextForeground(i, 0); j < num_columns;
+	 j = binary_image.NextForeground(i, j + 1))
+      pixels[j] = kMaxByteGrayLevels;
+  }
+}
+
+void RunLengthImage::AllocateSpaceAndSetSize(size_t num_rows,
+					     size_t num_columns) {
+  num_rows_ = num_rows;
+  num_columns_ = num_columns;
+  runs_.clear();
+  row_ends_.clear();
+  row_ends_.reserve(num_rows);
+}
+
+void EncodeRuns(const BinaryImage &binary_image, RunLengthImage *runs) {
+  if (runs == nullptr) abort();
+  const size_t num_rows = binary_image.num_rows();
+  const size_t num_columns = binary_image.num_columns();
+  runs->AllocateSpaceAndSetSize(num_rows, num_columns);
+  for (size_t i = 0; i < num_rows; ++i) {
+    for (size_t j = binary_image.NextForeground(i, 0); j < num_columns;) {
+      const size_t end = binary_image.NextBackground(i, j);
+      runs->AddRun(j, end);
+      j = binary_image.NextForeground(i, end);
     }
-    dx = xmax - xmin;
-    dy = ymax-ymin;    
+    runs->EndRow();
+  }
+}
 
-    if (dx >=0 ) {
-      mpCase = 1;
-      d = 2 * dx - dy;      
-    } else {
-      mpCase = 2;
-      d = 2 * dx + dy;      
+template <typename PixelType>
+void ThresholdToRuns(const Image<PixelType> &an_image, int threshold,
+		     RunLengthImage *runs) {
+  if (runs == nullptr) abort();
+  const size_t num_rows = an_image.num_rows();
+  const size_t num_columns = an_image.num_columns();
+  runs->AllocateSpaceAndSetSize(num_rows, num_columns);
+  for (size_t i = 0; i < num_rows; ++i) {
+    const PixelType *pixels = an_image.row(i);
+    size_t j = 0;
+    while (true) {
+      while (j < num_columns && !(threshold < pixels[j])) ++j;
+      if (j == num_columns) break;
+      const size_t first = j;
+      while (j < num_columns && threshold < pixels[j]) ++j;
+      runs->AddRun(first, j);
     }
+    runs->EndRow();
+  }
+}
 
-    incrNE = 2 * (dx - dy);
-    incrE = 2 * dx;
-    incrSE = 2 * (dx + dy);
+template <typename PixelType>
+void CopyImage(const RunLengthImage &runs, Image<PixelType> *an_image) {
+  if (an_image == nullptr) abort();
+  an_image->AllocateSpaceAndSetSize(runs.num_rows(), runs.num_columns());
+  an_image->SetNumberGrayLevels(kMaxByteGrayLevels);
+  for (size_t i = 0; i < runs.num_rows(); ++i) {
+    PixelType *pixels = an_image->row(i);
+    for (const RunLengthImage::Run *run = runs.row(i); run != runs.row_end(i);
+	 ++run)
+      fill(pixels + run->first_column, pixels + run->end_column,
+	   static_cast<PixelType>(kMaxByteGrayLevels));
   }
-  
-  /// Start the scan.
-  x = xmin;
-  y = ymin;
-  done = 0;
+}
 
-  while (!done) {
-    an_image->SetPixel(x,y,color);
-  
-    // Move to the next point.
-    switch(dir) {
-    case DIR_X: 
-      if (x < xmax) {
-	      switch(mpCase) {
-	      case 1:
-		if (d <= 0) {
-		  d += incrE;  
-		  x++;
-		} else {
-		  d += incrNE; 
-		  x++; 
-		  y++;
-		}
-		break;
-  
-            case 2:
-              if (d <= 0) {
-                d += incrSE; 
-		x++; 
-		y--;
-              } else {
-                d += incrE;  
-		x++;
-              }
-	      break;
-	      } 
-      } else {
-	done=1;
-      }     
-      break;
-
-    case DIR_Y: 
-        if (y < ymax) {
-          switch(mpCase) {
-	  case 1:
-	    if (d <= 0) {
-	      d += incrE;  
-	      y++;
-	    } else {
-	      d += incrNE; 
-	      y++; 
-	      x++;
-	    }
-            break;
-  
-	  case 2:
-	    if (d <= 0) {
-                d += incrSE; 
-		y++; 
-		x--;
-              } else {
-                d += incrE;  
-		y++;
-	    }
-            break;
-	  } // mpCase
-        } // y < ymin 
-        else {
-	  done=1;
-	}
-	break;    
+bool ReadBinaryImage(const string &input_filename,
+		     BinaryImage *binary_image) {
+  if (binary_image == nullptr) abort();
+  FILE *input = fopen(input_filename.c_str(), "rb");
+  if (input == 0) {
+    cout << "ReadBinaryImage: Cannot open file" << endl;
+    return false;
+  }
+  size_t num_rows, num_columns;
+  if (fgetc(input) != 'P' || fgetc(input) != '4' ||
+      !ReadHeaderField(input, &num_columns) ||
+      !ReadHeaderField(input, &num_rows)) {
+    fclose(input);
+    cout << "ReadBinaryImage: Expected .pbm file" << endl;
+    return false;
+  }
+  const size_t bytes_per_row = (num_columns + 7) / 8;
+  vector<unsigned char> bytes(num_rows * bytes_per_row);
+  const size_t bytes_read = fread(bytes.data(), 1, bytes.size(), input);
+  fclose(input);
+  if (bytes_read != bytes.size()) {
+    cout << "ReadBinaryImage: short file" << endl;
+    return false;
+  }
+
+  // pbm rows start with the leftmost pixel in the most significant bit;
+  // BinaryImage words start with it in the least significant one.
+  binary_image->AllocateSpaceAndSetSize(num_rows, num_columns);
+  const size_t last_bits = num_columns % BinaryImage::kBitsPerWord;
+  for (size_t i = 0; i < num_rows; ++i) {
+    const unsigned char *source = bytes.data() + i * bytes_per_row;
+    uint64_t *words = binary_image->row(i);
+    for (size_t b = 0; b < bytes_per_row; ++b)
+      words[b / 8] |= uint64_t{ReverseBits(source[b])} << (8 * (b % 8));
+    // Clear the padding bits of the last byte.
+    if (last_bits != 0)
+      words[binary_image->words_per_row() - 1] &=
+	(uint64_t{1} << last_bits) - 1;
+  }
+  return true;
+}
+
+bool WriteBinaryImage(const string &output_filename,
+		      const BinaryImage &binary_image) {
+  FILE *output = fopen(output_filename.c_str(), "wb");
+  if (output == 0) {
+    cout << "WriteBinaryImage: cannot open file" << endl;
+    return false;
+  }
+  const size_t num_rows = binary_image.num_rows();
+  const size_t num_columns = binary_image.num_columns();
+  fprintf(output, "P4\n"); // Magic number.
+  fprintf(output, "#\n");  // Empty comment.
+  fprintf(output, "%d %d\n", static_cast<int>(num_columns),
+	  static_cast<int>(num_rows));
+
+  const size_t bytes_per_row = (num_columns + 7) / 8;
+  vector<unsigned char> bytes(num_rows * bytes_per_row);
+  for (size_t i = 0; i < num_rows; ++i) {
+    const uint64_t *words = binary_image.row(i);
+    unsigned char *destination = bytes.data() + i * bytes_per_row;
+    for (size_t b = 0; b < bytes_per_row; ++b)
+      destination[b] = ReverseBits((words[b / 8] >> (8 * (b % 8))) & 0xff);
+  }
+  const bool written =
+    fwrite(bytes.data(), 1, bytes.size(), output) == bytes.size();
+  fclose(output);
+  if (!written) cout << "WriteBinaryImage: could not write" << endl;
+  return written;
+}
+
+bool IsPbmFilename(const string &filename) {
+  return HasExtension(filename, ".pbm");
+}
+
+MappedImage::MappedImage(MappedImage &&an_image) noexcept : MappedImage() {
+  *this = std::move(an_image);
+}
+
+MappedImage &MappedImage::operator=(MappedImage &&an_image) noexcept {
+  if (this == &an_image) return *this;
+  Unmap();
+  num_rows_ = an_image.num_rows_;
+  num_columns_ = an_image.num_columns_;
+  num_gray_levels_ = an_image.num_gray_levels_;
+  mapping_ = an_image.mapping_;
+  mapping_size_ = an_image.mapping_size_;
+  pixels_ = an_image.pixels_;
+
+  an_image.mapping_ = nullptr;
+  an_image.Unmap();
+  return *this;
+}
+
+MappedImage::~MappedImage() {
+  Unmap();
+}
+
+void MappedImage::Unmap() {
+  if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  pixels_ = nullptr;
+  num_rows_ = 0;
+  num_columns_ = 0;
+  num_gray_levels_ = 0;
+}
+
+bool MapImage(const string &filename, MappedImage *an_image) {
+  if (an_image == nullptr) abort();
+  FILE *input = fopen(filename.c_str(), "rb");
+  if (input == 0) {
+    cout << "MapImage: Cannot open file" << endl;
+    return false;
+  }
+
+  size_t num_rows, num_columns, levels;
+  if (!ReadPgmHeader(input, &num_rows, &num_columns, &levels)) {
+    fclose(input);
+    cout << "MapImage: Expected .pgm file" << endl;
+    return false;
+  }
+  if (levels > kMaxByteGrayLevels) {
+    fclose(input);
+    cout << "MapImage: Expected 8-bit .pgm file" << endl;
+    return false;
+  }
+  const long pixels_offset = ftell(input);
+
+  // Map the whole file: mmap() offsets must be page aligned.
+  struct stat file_status;
+  if (fstat(fileno(input), &file_status) != 0 ||
+      static_cast<size_t>(file_status.st_size) <
+      pixels_offset + num_rows * num_columns) {
+    fclose(input);
+    cout << "MapImage: short file" << endl;
+    return false;
+  }
+  const size_t mapping_size = file_status.st_size;
+  void *mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE,
+		       fileno(input), 0);
+  // The mapping stays valid after the file is closed.
+  fclose(input);
+  if (mapping == MAP_FAILED) {
+    cout << "MapImage: cannot map file" << endl;
+    return false;
+  }
+  madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+  an_image->Unmap();
+  an_image->num_rows_ = num_rows;
+  an_image->num_columns_ = num_columns;
+  an_image->num_gray_levels_ = levels;
+  an_image->mapping_ = mapping;
+  an_image->mapping_size_ = mapping_size;
+  an_image->pixels_ = static_cast<const uint8_t *>(mapping) + pixels_offset;
+  return true;
+}
+
+template <typename PixelType>
+void CopyImage(const MappedImage &mapped_image, Image<PixelType> *an_image) {
+  if (an_image == nullptr) abort();
+  const size_t num_rows = mapped_image.num_rows();
+  const size_t num_columns = mapped_image.num_columns();
+  an_image->AllocateSpaceAndSetSize(num_rows, num_columns);
+  an_image->SetNumberGrayLevels(mapped_image.num_gray_levels());
+  for (size_t i = 0; i < num_rows; ++i) {
+    const uint8_t *source = mapped_image.row(i);
+    PixelType *destination = an_image->row(i);
+    for (size_t j = 0; j < num_columns; ++j)
+      destination[j] = source[j];
+  }
+}
+
+template <typename PixelType>
+void IntegralImage::Compute(ImageView<const PixelType> an_image,
+			    bool squares) {
+  num_rows_ = an_image.num_rows();
+  num_columns_ = an_image.num_columns();
+  const size_t stride = num_columns_ + 1;
+  // Only row 0 and column 0 are not overwritten below.
+  sums_.resize((num_rows_ + 1) * stride);
+  square_sums_.resize(squares ? sums_.size() : 0);
+  fill(sums_.begin(), sums_.begin() + stride, 0);
+  if (squares) fill(square_sums_.begin(), square_sums_.begin() + stride, 0);
+  for (size_t i = 0; i < num_rows_; ++i) {
+    const PixelType *pixels = an_image.row(i);
+    const int64_t *above = &sums_[i * stride];
+    int64_t *sums = &sums_[(i + 1) * stride];
+    int64_t row_sum = 0;
+    sums[0] = 0;
+    for (size_t j = 0; j < num_columns_; ++j) {
+      row_sum += pixels[j];
+      sums[j + 1] = above[j + 1] + row_sum;
     }
+    if (!squares) continue;
+    const int64_t *squares_above = &square_sums_[i * stride];
+    int64_t *square_sums = &square_sums_[(i + 1) * stride];
+    int64_t row_square_sum = 0;
+    square_sums[0] = 0;
+    for (size_t j = 0; j < num_columns_; ++j) {
+      row_square_sum += static_cast<int64_t>(pixels[j]) * pixels[j];
+      square_sums[j + 1] = squares_above[j + 1] + row_square_sum;
+    }
+  }
+}
+
+namespace {
+
+// Cohen-Sutherland outcode of the point (x, y): one bit for each side
+// of the num_rows by num_columns image that the point lies beyond.
+int OutCode(long long x, long long y, long long num_rows,
+	    long long num_columns) {
+  return (x < 0 ? 1 : 0) | (x >= num_rows ? 2 : 0) |
+    (y < 0 ? 4 : 0) | (y >= num_columns ? 8 : 0);
+}
+
+// Returns the first k in [first, last] for which holds(k) is true, or
+// last + 1 if there is none. holds must be false and then true.
+template <typename Predicate>
+long long FirstStepWhere(long long first, long long last, Predicate holds) {
+  long long low = first;
+  long long high = last + 1;
+  while (low < high) {
+    const long long middle = low + (high - low) / 2;
+    if (holds(middle))
+      high = middle;
+    else
+      low = middle + 1;
   }
+  return low;
 }
 
+// Draws the part of the line from (x0,y0) to (x1,y1) that lies inside
+// an_image. The pixels drawn are exactly the ones inside the image of
+// the unclipped line given by Bresenham's incremental midpoint
+// algorithm (J.D.Foley, A. van Dam, S.K.Feiner, J.F.Hughes,
+// "Computer Graphics. Principles and practice", 2nd ed., 1990,
+// section 3.2.2), so no pixel needs a bounds check.
+template <typename PixelType>
+void DrawClippedLine(int x0, int y0, int x1, int y1, int color,
+		     Image<PixelType> *an_image) {
+  const long long num_rows = an_image->num_rows();
+  const long long num_columns = an_image->num_columns();
+  const int out0 = OutCode(x0, y0, num_rows, num_columns);
+  const int out1 = OutCode(x1, y1, num_rows, num_columns);
+  // Both ends beyond the same side: nothing of the line is visible.
+  if ((out0 & out1) != 0) return;
+
+  // The line takes one pixel per step along its major axis u, and
+  // sometimes one along its minor axis v. As in the original algorithm
+  // x is the major axis when |dx| > |dy|, and the line is walked from
+  // the end with the smaller u.
+  const long long dx = static_cast<long long>(x1) - x0;
+  const long long dy = static_cast<long long>(y1) - y0;
+  const bool x_major = llabs(dx) > llabs(dy);
+  long long u0 = x_major ? x0 : y0;
+  long long v0 = x_major ? y0 : x0;
+  long long u1 = x_major ? x1 : y1;
+  long long v1 = x_major ? y1 : x1;
+  if (u1 < u0) {
+    swap(u0, u1);
+    swap(v0, v1);
+  }
+  const long long du = u1 - u0;
+  const long long dv = v1 - v0;
+  const long long v_step = (dv >= 0) ? 1 : -1;
+  const long long a = dv * v_step;
+  // The midpoint decision goes to v on a tie only when v decreases.
+  const long long tie = (dv >= 0) ? 0 : 1;
+  const long long u_size = x_major ? num_rows : num_columns;
+  const long long v_size = x_major ? num_columns : num_rows;
+
+  // Minor coordinate of the pixel after k steps, i.e. the closed form
+  // of the midpoint decisions. 2 * a * k needs more than 64 bits for
+  // the longest lines.
+  auto minor = [=](long long k) -> long long {
+    if (du == 0) return v0;
+    return v0 + v_step * static_cast<long long>(
+      (static_cast<__int128>(2 * a) * k + du - 1 + tie) / (2 * du));
+  };
+
+  // Clip the steps to the image: u bounds them directly, and as v only
+  // moves one way its bounds are found by bisection.
+  long long first = max(0LL, -u0);
+  long long last = min(du, u_size - 1 - u0);
+  if ((out0 | out1) != 0 && first <= last) {
+    if (v_step > 0) {
+      first = FirstStepWhere(first, last,
+			     [&](long long k) { return minor(k) >= 0; });
+      last = FirstStepWhere(first, last,
+			    [&](long long k) { return minor(k) >= v_size; }) - 1;
+    } else {
+      first = FirstStepWhere(first, last,
+			     [&](long long k) { return minor(k) < v_size; });
+      last = FirstStepWhere(first, last,
+			    [&](long long k) { return minor(k) < 0; }) - 1;
+    }
+  }
+  if (first > last) return;
+
+  // Walk the visible steps incrementally, starting from the decision
+  // variable the original algorithm has at step first.
+  const PixelType pixel = static_cast<PixelType>(color);
+  long long u = u0 + first;
+  long long v = minor(first);
+  long long d = static_cast<long long>(
+    static_cast<__int128>(2 * a) * (first + 1) - du + tie -
+    static_cast<__int128>(2 * du) * ((v - v0) * v_step));
+  for (long long k = first; k <= last; ++k, ++u) {
+    if (x_major)
+      an_image->row(u)[v] = pixel;
+    else
+      an_image->row(v)[u] = pixel;
+    if (d > 0) {
+      v += v_step;
+      d += 2 * (a - du);
+    } else {
+      d += 2 * a;
+    }
+  }
+}
+
+}  // namespace
+
+template <typename PixelType>
+void DrawLine(int x0, int y0, int x1, int y1, int color,
+	      Image<PixelType> *an_image) {
+  if (an_image == nullptr) abort();
+  DrawClippedLine(x0, y0, x1, y1, color, an_image);
+}
+
+template <typename PixelType>
+void DrawLines(const vector<int> &lines, int color,
+	       Image<PixelType> *an_image) {
+  if (an_image == nullptr || lines.size() % 4 != 0) abort();
+  for (size_t i = 0; i < lines.size(); i += 4)
+    DrawClippedLine(lines[i], lines[i + 1], lines[i + 2], lines[i + 3],
+		    color, an_image);
+}
+
+// Explicit instantiations for the supported pixel depths.
+#define INSTANTIATE_IMAGE(PixelType)					\
+  template class Image<PixelType>;					\
+  template class ImagePool<PixelType>;					\
+  template bool ReadImage(const string &, Image<PixelType> *);		\
+  template bool WriteImage(const string &, const Image<PixelType> &);	\
+  template void DrawLine(int, int, int, int, int, Image<PixelType> *);	\
+  template void DrawLines(const vector<int> &, int, Image<PixelType> *); \
+  template void CopyImage(const MappedImage &, Image<PixelType> *);	\
+  template void ThresholdToBinary(const Image<PixelType> &, int,	\
+				  BinaryImage *);			\
+  template void CopyImage(const BinaryImage &, Image<PixelType> *);	\
+  template void ThresholdToRuns(const Image<PixelType> &, int,		\
+				RunLengthImage *);			\
+  template void CopyImage(const RunLengthImage &, Image<PixelType> *);	\
+  template bool PgmBandReader::ReadBand(size_t, size_t, Image<PixelType> *); \
+  template bool PgmBandWriter::WriteRows(const Image<PixelType> &,	\
+					 size_t, size_t);
+
+INSTANTIATE_IMAGE(uint8_t)
+INSTANTIATE_IMAGE(uint16_t)
+INSTANTIATE_IMAGE(int32_t)
+INSTANTIATE_IMAGE(float)
+
+#undef INSTANTIATE_IMAGE
+
+// Summed-area tables are kept for integer pixels only.
+template void IntegralImage::Compute(ImageView<const uint8_t>, bool);
+template void IntegralImage::Compute(ImageView<const uint16_t>, bool);
+template void IntegralImage::Compute(ImageView<const int32_t>, bool);
+
 }  // namespace ComputerVisionProjects
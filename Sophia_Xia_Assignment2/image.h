@@ -1,5 +1,5 @@
 // Sophia Xia
-// I did not modify or add any code to this file
+// Extended from the version of this file provided for the class.
 
 // Class for representing a 2D gray-scale image,
 // with support for reading/writing pgm images.
@@ -8,14 +8,133 @@
 #ifndef COMPUTER_VISION_IMAGE_H_
 #define COMPUTER_VISION_IMAGE_H_
 
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
+
+// The checked accessors SetPixel() and GetPixel() always verify their
+// coordinates. The fast accessors (row(), PixelSpan) only do so when
+// compiled with -DCOMPUTER_VISION_CHECKED_ACCESS, e.g. in debug builds.
+#ifdef COMPUTER_VISION_CHECKED_ACCESS
+#define COMPUTER_VISION_CHECK(condition) if (!(condition)) abort()
+#else
+#define COMPUTER_VISION_CHECK(condition)
+#endif
 
 namespace ComputerVisionProjects {
- 
-// Class for representing a gray-scale image.
+
+// A contiguous run of pixels, such as one row of an image.
+// Can be used in range-based for loops:
+//   for (uint8_t &pixel : an_image.row_span(i)) pixel = 255 - pixel;
+template <typename PixelType>
+class PixelSpan {
+ public:
+  PixelSpan(PixelType *first, size_t size): first_{first}, size_{size} { }
+
+  PixelType *begin() const { return first_; }
+  PixelType *end() const { return first_ + size_; }
+  size_t size() const { return size_; }
+
+  PixelType &operator[](size_t j) const {
+    COMPUTER_VISION_CHECK(j < size_);
+    return first_[j];
+  }
+
+ private:
+  PixelType *first_;
+  size_t size_;
+};
+
+// A non-owning view of a rectangle of pixels of an image, e.g. a
+// region of interest: functions that take a view process the rectangle
+// in place, without copying its pixels. Row i of the view starts
+// stride() pixels after row i - 1. first_row() and first_column() are
+// the position of the view in the image it was taken from.
+// The view is only valid while that image is alive and not resized.
+// Sample usage:
+//   ImageView<uint8_t> roi = an_image.view(10, 20, 100, 50);
+//   for (uint8_t &pixel : roi.row_span(0)) pixel = 0;
+template <typename PixelType>
+class ImageView {
+ public:
+  ImageView(): origin_{nullptr}, num_rows_{0}, num_columns_{0}, stride_{0},
+	       first_row_{0}, first_column_{0} { }
+
+  ImageView(PixelType *origin, size_t num_rows, size_t num_columns,
+	    size_t stride, size_t first_row = 0, size_t first_column = 0):
+    origin_{origin}, num_rows_{num_rows}, num_columns_{num_columns},
+    stride_{stride}, first_row_{first_row}, first_column_{first_column} { }
+
+  // A view of pixels can be used as a view of const pixels.
+  template <typename OtherPixelType>
+  ImageView(const ImageView<OtherPixelType> &a_view):
+    origin_{a_view.origin_}, num_rows_{a_view.num_rows_},
+    num_columns_{a_view.num_columns_}, stride_{a_view.stride_},
+    first_row_{a_view.first_row_}, first_column_{a_view.first_column_} { }
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+  size_t stride() const { return stride_; }
+  size_t first_row() const { return first_row_; }
+  size_t first_column() const { return first_column_; }
+
+  void SetPixel(size_t i, size_t j, PixelType gray_level) const {
+    if (i >= num_rows_ || j >= num_columns_) abort();
+    origin_[i * stride_ + j] = gray_level;
+  }
+
+  PixelType GetPixel(size_t i, size_t j) const {
+    if (i >= num_rows_ || j >= num_columns_) abort();
+    return origin_[i * stride_ + j];
+  }
+
+  PixelType *row(size_t i) const {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return origin_ + i * stride_;
+  }
+  PixelSpan<PixelType> row_span(size_t i) const {
+    return PixelSpan<PixelType>(row(i), num_columns_);
+  }
+
+  // The rectangle of num_rows by num_columns pixels of this view that
+  // starts at (first_row, first_column), clipped to this view.
+  ImageView view(size_t first_row, size_t first_column, size_t num_rows,
+		 size_t num_columns) const {
+    first_row = first_row < num_rows_ ? first_row : num_rows_;
+    first_column = first_column < num_columns_ ? first_column : num_columns_;
+    if (num_rows > num_rows_ - first_row) num_rows = num_rows_ - first_row;
+    if (num_columns > num_columns_ - first_column)
+      num_columns = num_columns_ - first_column;
+    return ImageView(origin_ + first_row * stride_ + first_column, num_rows,
+		     num_columns, stride_, first_row_ + first_row,
+		     first_column_ + first_column);
+  }
+
+ private:
+  template <typename OtherPixelType> friend class ImageView;
+
+  PixelType *origin_;
+  size_t num_rows_;
+  size_t num_columns_;
+  size_t stride_;
+  size_t first_row_;
+  size_t first_column_;
+};
+
+// Returns the smallest rectangle of first that contains every pixel
+// above threshold in both first and second (an empty view if there is
+// none). The two views must have the same size; taking the same
+// rectangle of second gives the matching pixels of second.
+ImageView<const uint8_t> ObjectRegion(ImageView<const uint8_t> first,
+				      ImageView<const uint8_t> second,
+				      int threshold);
+
+// Class for representing a gray-scale image whose pixels are of type
+// PixelType. Instantiated for uint8_t, uint16_t, int32_t and float.
 // Sample usage:
-//   Image one_image;
+//   Image<uint8_t> one_image;
 //   one_image.AllocateSpaceAndSetSize(100, 200);
 //   one_image.SetNumberGrayLevels(255);
 //   // Creates and image such that each pixel is 150.
@@ -24,63 +143,648 @@ namespace ComputerVisionProjects {
 //       one_image.SetPixel(i, j, 150);
 //   WriteImage("output_file.pgm", an_image);
 //   // See image_demo.cc for read/write image.
+template <typename PixelType>
 class Image {
  public:
-  Image(): num_rows_{0}, num_columns_{0}, 
-	   num_gray_levels_{0}, pixels_{nullptr} { }
+  Image(): num_rows_{0}, num_columns_{0}, stride_{0}, capacity_{0},
+	   num_gray_levels_{0}, huge_pages_{false}, pixels_{nullptr} { }
   
   Image(const Image &an_image);
-  Image& operator=(const Image &an_image) = delete;
+  Image& operator=(const Image &an_image);
+
+  // Moving an image hands over its buffer; an_image is left empty.
+  Image(Image &&an_image) noexcept;
+  Image& operator=(Image &&an_image) noexcept;
 
   ~Image();
 
+  // Returns a deep copy of the image (one memcpy of the buffer).
+  Image Clone() const { return Image(*this); }
+
+  // Asks for buffers of at least 2 MiB to be backed by transparent huge
+  // pages, which cuts page faults and TLB misses on large accumulators.
+  // Applies from the next time the buffer is (re)allocated.
+  void UseHugePages(bool huge_pages) { huge_pages_ = huge_pages; }
+
   // Sets the size of the image to the given
   // height (num_rows) and columns (num_columns).
+  // All pixels are set to 0. The current buffer is reused
+  // when it is large enough for the new size.
   void AllocateSpaceAndSetSize(size_t num_rows, size_t num_columns);
 
   size_t num_rows() const { return num_rows_; }
   size_t num_columns() const { return num_columns_; }
   size_t num_gray_levels() const { return num_gray_levels_; }
+  // Distance, in pixels, between the starts of two consecutive rows.
+  // Rows are padded so that every row starts on a cache line.
+  size_t stride() const { return stride_; }
+  // Number of pixels the buffer can hold without reallocating.
+  size_t capacity() const { return capacity_; }
   void SetNumberGrayLevels(size_t gray_levels) {
     num_gray_levels_ = gray_levels;
   }
  
   // Sets the pixel in the image at row i and column j
   // to a particular gray_level.
-  void SetPixel(size_t i, size_t j, int gray_level) {
+  void SetPixel(size_t i, size_t j, PixelType gray_level) {
     if (i >= num_rows_ || j >= num_columns_) abort();
-    pixels_[i][j] = gray_level;
+    pixels_[i * stride_ + j] = gray_level;
   }
 
-  int GetPixel(size_t i, size_t j) const {
+  PixelType GetPixel(size_t i, size_t j) const {
     if (i >= num_rows_ || j >= num_columns_) abort();
-    return pixels_[i][j];
+    return pixels_[i * stride_ + j];
+  }
+
+  // Unchecked access for hot loops: row(i)[j] is the pixel at row i and
+  // column j, for j < num_columns(). Walking a row through this pointer
+  // lets the compiler vectorize the loop.
+  PixelType *row(size_t i) {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return pixels_ + i * stride_;
+  }
+  const PixelType *row(size_t i) const {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return pixels_ + i * stride_;
+  }
+
+  // Row i as a span of num_columns() pixels.
+  PixelSpan<PixelType> row_span(size_t i) {
+    return PixelSpan<PixelType>(row(i), num_columns_);
+  }
+  PixelSpan<const PixelType> row_span(size_t i) const {
+    return PixelSpan<const PixelType>(row(i), num_columns_);
+  }
+
+  // The whole pixel buffer as one span of num_rows() * stride() pixels.
+  // It includes the padding at the end of every row, so it suits point
+  // operations (thresholds, lookups); reductions such as histograms
+  // should walk row_span() instead.
+  PixelSpan<PixelType> pixels() {
+    return PixelSpan<PixelType>(pixels_, num_rows_ * stride_);
+  }
+  PixelSpan<const PixelType> pixels() const {
+    return PixelSpan<const PixelType>(pixels_, num_rows_ * stride_);
+  }
+
+  // The whole image as a view that shares its pixels.
+  ImageView<PixelType> view() {
+    return ImageView<PixelType>(pixels_, num_rows_, num_columns_, stride_);
+  }
+  ImageView<const PixelType> view() const {
+    return ImageView<const PixelType>(pixels_, num_rows_, num_columns_,
+				      stride_);
+  }
+
+  // The rectangle of num_rows by num_columns pixels that starts at
+  // (first_row, first_column), clipped to the image, as a view.
+  ImageView<PixelType> view(size_t first_row, size_t first_column,
+			    size_t num_rows, size_t num_columns) {
+    return view().view(first_row, first_column, num_rows, num_columns);
+  }
+  ImageView<const PixelType> view(size_t first_row, size_t first_column,
+				  size_t num_rows, size_t num_columns) const {
+    return view().view(first_row, first_column, num_rows, num_columns);
   }
 
  private:
+  // Like AllocateSpaceAndSetSize(), but leaves the pixels uninitialized.
+  void SetSize(size_t num_rows, size_t num_columns);
   void DeallocateSpace();
 
+  // Alignment of the pixel buffer and of every row in it.
+  static const size_t kCacheLineSize = 64;
+  // Size of a (transparent) huge page on x86-64.
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
   size_t num_rows_; 
   size_t num_columns_; 
+  size_t stride_;
+  // Number of pixels the buffer can hold, at least num_rows_ * stride_.
+  size_t capacity_;
   size_t num_gray_levels_;  
-  int **pixels_;
+  bool huge_pages_;
+  // All rows in one contiguous block; row i starts at pixels_ + i * stride_.
+  PixelType *pixels_;
 };
 
+// A pool of images that the stages of a pipeline draw their
+// intermediate images from and give back when they are done with them.
+// Processing many frames then reuses the same few buffers instead of
+// allocating, and page faulting, fresh ones for every frame.
+// Sample usage:
+//   ImagePool<int32_t> pool;
+//   for (...) {
+//     Image<int32_t> votes = pool.Acquire(rows, columns);
+//     ...
+//     pool.Release(&votes);
+//   }
+template <typename PixelType>
+class ImagePool {
+ public:
+  // With use_huge_pages, the buffers of large images (such as vote
+  // accumulators) are backed by transparent huge pages where available.
+  explicit ImagePool(bool use_huge_pages = false):
+    use_huge_pages_{use_huge_pages} { }
+
+  ImagePool(const ImagePool &pool) = delete;
+  ImagePool& operator=(const ImagePool &pool) = delete;
+
+  // Returns a num_rows by num_columns image with all pixels 0, in the
+  // smallest pooled buffer that is large enough (a new one if the pool
+  // is empty).
+  Image<PixelType> Acquire(size_t num_rows, size_t num_columns);
+
+  // Returns a copy of an_image in a pooled buffer.
+  Image<PixelType> Acquire(const Image<PixelType> &an_image);
+
+  // Gives the buffer of an_image back to the pool; an_image is left empty.
+  void Release(Image<PixelType> *an_image);
+
+  // Number of buffers waiting in the pool.
+  size_t size() const { return images_.size(); }
+
+ private:
+  // Removes from the pool the image best suited to hold num_pixels.
+  Image<PixelType> Take(size_t num_pixels);
+
+  bool use_huge_pages_;
+  std::vector<Image<PixelType>> images_;
+};
+
+// Read-only view of an 8-bit pgm file mapped into memory with mmap().
+// Nothing is allocated or copied: row(i) points straight at the pixel
+// bytes of the file, so repeated opens of the same file are served from
+// the page cache. The mapping is released when the object is destroyed.
+// Sample usage:
+//   MappedImage an_image;
+//   if (MapImage("input_file.pgm", &an_image))
+//     for (uint8_t pixel : an_image.row_span(0)) ...
+class MappedImage {
+ public:
+  MappedImage(): num_rows_{0}, num_columns_{0}, num_gray_levels_{0},
+		 mapping_{nullptr}, mapping_size_{0}, pixels_{nullptr} { }
+
+  MappedImage(const MappedImage &an_image) = delete;
+  MappedImage& operator=(const MappedImage &an_image) = delete;
+
+  MappedImage(MappedImage &&an_image) noexcept;
+  MappedImage& operator=(MappedImage &&an_image) noexcept;
+
+  ~MappedImage();
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+  size_t num_gray_levels() const { return num_gray_levels_; }
+  // Rows are stored back to back, as in the file.
+  size_t stride() const { return num_columns_; }
+
+  uint8_t GetPixel(size_t i, size_t j) const {
+    if (i >= num_rows_ || j >= num_columns_) abort();
+    return pixels_[i * num_columns_ + j];
+  }
+
+  const uint8_t *row(size_t i) const {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return pixels_ + i * num_columns_;
+  }
+  PixelSpan<const uint8_t> row_span(size_t i) const {
+    return PixelSpan<const uint8_t>(row(i), num_columns_);
+  }
+  // All pixels as one span; there is no padding between rows.
+  PixelSpan<const uint8_t> pixels() const {
+    return PixelSpan<const uint8_t>(pixels_, num_rows_ * num_columns_);
+  }
+
+  // The whole image, or a clipped rectangle of it, as a view.
+  ImageView<const uint8_t> view() const {
+    return ImageView<const uint8_t>(pixels_, num_rows_, num_columns_,
+				    num_columns_);
+  }
+  ImageView<const uint8_t> view(size_t first_row, size_t first_column,
+				size_t num_rows, size_t num_columns) const {
+    return view().view(first_row, first_column, num_rows, num_columns);
+  }
+
+ private:
+  friend bool MapImage(const std::string &input_filename,
+		       MappedImage *an_image);
+  void Unmap();
+
+  size_t num_rows_;
+  size_t num_columns_;
+  size_t num_gray_levels_;
+  // The whole file as returned by mmap(); pixels_ points past its header.
+  void *mapping_;
+  size_t mapping_size_;
+  const uint8_t *pixels_;
+};
+
+// Maps the 8-bit pgm file input_filename into memory.
+// an_image is the resulting read-only view.
+// Returns true if  everyhing is OK, false otherwise.
+bool MapImage(const std::string &input_filename, MappedImage *an_image);
+
+// Copies a mapped image into an_image, e.g. to draw on it.
+template <typename PixelType>
+void CopyImage(const MappedImage &mapped_image, Image<PixelType> *an_image);
+
 // Reads a pgm image from file input_filename.
-// an_image is the resulting image.
+// an_image is the resulting image; each pixel of the file is
+// converted to PixelType. Files with more than 255 gray levels
+// store two bytes per pixel and need a PixelType wider than uint8_t;
+// reading them into a narrower PixelType fails instead of truncating.
 // Returns true if  everyhing is OK, false otherwise.
-bool ReadImage(const std::string &input_filename, Image *an_image);
+template <typename PixelType>
+bool ReadImage(const std::string &input_filename, Image<PixelType> *an_image);
+
+// Reads only the header of the pgm file input_filename, e.g. to tell
+// 16-bit files from the 8-bit ones MapImage() can map.
+// Returns true if  everyhing is OK, false otherwise.
+bool ReadImageHeader(const std::string &input_filename, size_t *num_rows,
+		     size_t *num_columns, size_t *num_gray_levels);
 
 // Writes image an_iamge into the pgm file output_filename.
+// If num_gray_levels() is at most 255 each pixel is written as one
+// byte, i.e. modulo 256. Otherwise the 16-bit variant is written:
+// two big-endian bytes per pixel, clamped to [0, 65535].
+// Returns true if  everyhing is OK, false otherwise.
+template <typename PixelType>
+bool WriteImage(const std::string &output_filename,
+		const Image<PixelType> &an_image);
+
+// Label images hold the component of every pixel as a 32-bit integer, so
+// that they are not limited to the 65535 gray levels of a pgm file. The
+// file has a pgm-like header: the magic number "L32", the width, the
+// height and the largest label, in decimal, then four big-endian bytes
+// per pixel (two's complement), row by row.
+
+// Reads the label image input_filename into labels; the largest label of
+// the file becomes labels->num_gray_levels().
 // Returns true if  everyhing is OK, false otherwise.
-bool WriteImage(const std::string &output_filename, const Image &an_image);
+bool ReadLabelImage(const std::string &input_filename, Image<int32_t> *labels);
+
+// Writes labels into the label image output_filename; the largest label
+// written in the header is labels.num_gray_levels().
+// Returns true if  everyhing is OK, false otherwise.
+bool WriteLabelImage(const std::string &output_filename,
+		     const Image<int32_t> &labels);
+
+// Returns true if filename ends with ".lbl".
+bool IsLabelFilename(const std::string &filename);
+
+// Writes a false-color preview of labels into the binary (P6) ppm file
+// output_filename: the background (label 0) is black and every other
+// label gets a color hashed from its value, so that neighboring
+// components can be told apart at a glance.
+// Returns true if  everyhing is OK, false otherwise.
+bool WriteLabelPreview(const std::string &output_filename,
+		       const Image<int32_t> &labels);
+
+// Reads a pgm file a band of rows at a time, so that images taller than
+// the available memory can be processed with bounded memory.
+// Neighborhood operators can ask for a halo of extra rows above and
+// below every band; those rows are kept from the previous band rather
+// than read again.
+// Sample usage:
+//   PgmBandReader reader;
+//   Image<uint8_t> band;
+//   if (!reader.Open("input_file.pgm")) ...
+//   while (reader.ReadBand(64, 1, &band)) {
+//     // Row reader.halo_above() of band is row reader.first_row()
+//     // of the image, followed by reader.band_rows() - 1 more rows.
+//   }
+class PgmBandReader {
+ public:
+  PgmBandReader(): input_{nullptr}, num_rows_{0}, num_columns_{0},
+		   num_gray_levels_{0}, bytes_per_pixel_{1}, next_row_{0},
+		   window_first_row_{0}, first_row_{0}, band_rows_{0},
+		   halo_above_{0} { }
+
+  PgmBandReader(const PgmBandReader &reader) = delete;
+  PgmBandReader& operator=(const PgmBandReader &reader) = delete;
+
+  ~PgmBandReader();
+
+  // Opens input_filename and reads its header.
+  // Returns true if  everyhing is OK, false otherwise.
+  bool Open(const std::string &input_filename);
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+  size_t num_gray_levels() const { return num_gray_levels_; }
+
+  // Reads the next band_rows rows (fewer at the bottom of the image)
+  // into band, together with up to halo rows above and below them.
+  // Returns false when all rows have been read, or on a read error.
+  template <typename PixelType>
+  bool ReadBand(size_t band_rows, size_t halo, Image<PixelType> *band);
+
+  // Describe the last band read: the image row of its first non-halo
+  // row, its number of non-halo rows, and the halo rows above them.
+  size_t first_row() const { return first_row_; }
+  size_t band_rows() const { return band_rows_; }
+  size_t halo_above() const { return halo_above_; }
+
+ private:
+  FILE *input_;
+  size_t num_rows_;
+  size_t num_columns_;
+  size_t num_gray_levels_;
+  size_t bytes_per_pixel_;
+  // First non-halo row of the next band.
+  size_t next_row_;
+  // Raw bytes of the rows read from the file and still needed, starting
+  // at image row window_first_row_.
+  std::vector<unsigned char> window_;
+  size_t window_first_row_;
+  size_t first_row_;
+  size_t band_rows_;
+  size_t halo_above_;
+};
+
+// Writes a pgm file a band of rows at a time; the counterpart of
+// PgmBandReader. Rows must be written top to bottom.
+class PgmBandWriter {
+ public:
+  PgmBandWriter(): output_{nullptr}, num_rows_{0}, num_columns_{0},
+		   bytes_per_pixel_{1}, rows_written_{0} { }
+
+  PgmBandWriter(const PgmBandWriter &writer) = delete;
+  PgmBandWriter& operator=(const PgmBandWriter &writer) = delete;
+
+  ~PgmBandWriter();
+
+  // Creates output_filename and writes the header of a
+  // num_rows by num_columns image (see WriteImage for the format).
+  // Returns true if  everyhing is OK, false otherwise.
+  bool Open(const std::string &output_filename, size_t num_rows,
+	    size_t num_columns, size_t num_gray_levels);
+
+  // Appends rows [first_band_row, first_band_row + num_rows) of band.
+  // Returns true if  everyhing is OK, false otherwise.
+  template <typename PixelType>
+  bool WriteRows(const Image<PixelType> &band, size_t first_band_row,
+		 size_t num_rows);
+
+  // Closes the file. Returns false if some rows were never written.
+  bool Close();
+
+ private:
+  FILE *output_;
+  size_t num_rows_;
+  size_t num_columns_;
+  size_t bytes_per_pixel_;
+  size_t rows_written_;
+  // Conversion buffer, reused from one band to the next.
+  std::vector<unsigned char> bytes_;
+};
+
+// A binary image packed 64 pixels to a 64-bit word, 32 times smaller
+// than an Image<int32_t>. Pixel (i, j) is bit j % 64 of word j / 64 of
+// row i; it is 1 for the foreground (white, 255, in a pgm image) and 0
+// for the background. The bits past num_columns() in the last word of
+// every row are always 0, so whole words can be tested and counted.
+// The bits are written to pbm files as they are, and pbm viewers show
+// 1 as black: a pbm file of the image looks inverted next to the pgm
+// one (black objects on white), but reads back to the same pixels.
+// Sample usage:
+//   BinaryImage binary_image;
+//   ThresholdToBinary(an_image, 125, &binary_image);
+//   for (size_t j = binary_image.NextForeground(i, 0);
+//        j < binary_image.num_columns();
+//        j = binary_image.NextForeground(i, j + 1)) ...
+class BinaryImage {
+ public:
+  BinaryImage(): num_rows_{0}, num_columns_{0}, words_per_row_{0} { }
+
+  // Sets the size of the image; all pixels are set to 0.
+  // The current buffer is reused when it is large enough.
+  void AllocateSpaceAndSetSize(size_t num_rows, size_t num_columns);
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+  size_t words_per_row() const { return words_per_row_; }
+
+  void SetPixel(size_t i, size_t j, bool foreground) {
+    if (i >= num_rows_ || j >= num_columns_) abort();
+    const uint64_t bit = uint64_t{1} << (j % kBitsPerWord);
+    if (foreground)
+      words_[i * words_per_row_ + j / kBitsPerWord] |= bit;
+    else
+      words_[i * words_per_row_ + j / kBitsPerWord] &= ~bit;
+  }
+
+  bool GetPixel(size_t i, size_t j) const {
+    if (i >= num_rows_ || j >= num_columns_) abort();
+    return (words_[i * words_per_row_ + j / kBitsPerWord] >>
+	    (j % kBitsPerWord)) & 1;
+  }
+
+  // Unchecked access to the words_per_row() words of row i.
+  uint64_t *row(size_t i) {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return words_.data() + i * words_per_row_;
+  }
+  const uint64_t *row(size_t i) const {
+    COMPUTER_VISION_CHECK(i < num_rows_);
+    return words_.data() + i * words_per_row_;
+  }
+
+  // Returns the column of the first foreground pixel of row i at or
+  // after column j, or num_columns() if there is none. Background is
+  // skipped a word (64 pixels) at a time.
+  size_t NextForeground(size_t i, size_t j) const;
+
+  // Same for the first background pixel; foreground is skipped a word at
+  // a time.
+  size_t NextBackground(size_t i, size_t j) const;
+
+  // Number of foreground pixels in the image.
+  size_t CountForeground() const;
+
+  static const size_t kBitsPerWord = 64;
+
+ private:
+  size_t num_rows_;
+  size_t num_columns_;
+  size_t words_per_row_;
+  std::vector<uint64_t> words_;
+};
+
+// Sets binary_image to the pixels of an_image above threshold.
+template <typename PixelType>
+void ThresholdToBinary(const Image<PixelType> &an_image, int threshold,
+		       BinaryImage *binary_image);
+
+// Copies a binary image into an_image as 0 and 255.
+template <typename PixelType>
+void CopyImage(const BinaryImage &binary_image, Image<PixelType> *an_image);
+
+// Sets each of the count pixels to 255 if it is above threshold, to 0
+// otherwise. The pixels are compared 16 at a time with SSE2 (32 with
+// AVX2, when compiled with -mavx2), with the same results as one at a
+// time.
+void ThresholdPixels(uint8_t *pixels, size_t count, int threshold);
+void ThresholdPixels(int32_t *pixels, size_t count, int threshold);
+
+// Reads a binary (P4) pbm image from file input_filename.
+// In pbm files 1 is black; here it is read as foreground.
+// Returns true if  everyhing is OK, false otherwise.
+bool ReadBinaryImage(const std::string &input_filename,
+		     BinaryImage *binary_image);
+
+// Writes binary_image into the binary (P4) pbm file output_filename,
+// one bit per pixel, each row padded to a whole byte. The foreground
+// is written as 1, which pbm viewers show as black.
+// Returns true if  everyhing is OK, false otherwise.
+bool WriteBinaryImage(const std::string &output_filename,
+		      const BinaryImage &binary_image);
+
+// Returns true if filename ends with ".pbm".
+bool IsPbmFilename(const std::string &filename);
+
+// A binary image as the runs of foreground pixels of every row, left to
+// right, all rows one after the other. Thresholded images are mostly long
+// runs, and their components and moments can be found a run at a time.
+// Sample usage:
+//   RunLengthImage runs;
+//   EncodeRuns(binary_image, &runs);
+//   for (size_t i = 0; i < runs.num_rows(); ++i)
+//     for (const RunLengthImage::Run *run = runs.row(i);
+//          run != runs.row_end(i); ++run) ...
+class RunLengthImage {
+ public:
+  // The foreground pixels of columns [first_column, end_column).
+  struct Run {
+    int32_t first_column;
+    int32_t end_column;
+  };
+
+  RunLengthImage(): num_rows_{0}, num_columns_{0} { }
+
+  // Removes all the runs and sets the size of the image; the rows are
+  // then added in order, each with AddRun() for its runs, left to right,
+  // then EndRow(). The buffers are reused.
+  void AllocateSpaceAndSetSize(size_t num_rows, size_t num_columns);
+  void AddRun(size_t first_column, size_t end_column) {
+    runs_.push_back({static_cast<int32_t>(first_column),
+		     static_cast<int32_t>(end_column)});
+  }
+  void EndRow() { row_ends_.push_back(runs_.size()); }
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+  // Number of runs in the image, and in row i.
+  size_t num_runs() const { return runs_.size(); }
+  size_t num_runs(size_t i) const { return row_end(i) - row(i); }
+
+  // The runs of row i, from row(i) up to row_end(i); runs of consecutive
+  // rows are consecutive, and run k of the image is runs()[k].
+  const Run *row(size_t i) const {
+    COMPUTER_VISION_CHECK(i < row_ends_.size());
+    return runs_.data() + (i == 0 ? 0 : row_ends_[i - 1]);
+  }
+  const Run *row_end(size_t i) const {
+    COMPUTER_VISION_CHECK(i < row_ends_.size());
+    return runs_.data() + row_ends_[i];
+  }
+  const std::vector<Run> &runs() const { return runs_; }
+
+ private:
+  size_t num_rows_;
+  size_t num_columns_;
+  std::vector<Run> runs_;
+  // Index in runs_ past the last run of every row added.
+  std::vector<size_t> row_ends_;
+};
+
+// Sets runs to the foreground of binary_image, found a word at a time.
+void EncodeRuns(const BinaryImage &binary_image, RunLengthImage *runs);
+
+// Sets runs to the pixels of an_image above threshold.
+template <typename PixelType>
+void ThresholdToRuns(const Image<PixelType> &an_image, int threshold,
+		     RunLengthImage *runs);
+
+// Copies a run-length image into an_image as 0 and 255.
+template <typename PixelType>
+void CopyImage(const RunLengthImage &runs, Image<PixelType> *an_image);
+
+// Summed-area table of an image (F. Crow, "Summed-area tables for
+// texture mapping", SIGGRAPH 1984): after one pass over the image, the
+// sum of any rectangle of it takes four lookups, whatever its size.
+// The sums of the squared pixels can be kept too, for local variances.
+// Sample usage:
+//   IntegralImage integral;
+//   integral.Compute(an_image.view(), true);
+//   // Mean of the 16 by 16 pixels from (10, 20).
+//   double mean = integral.Sum(10, 20, 26, 36) / 256.0;
+class IntegralImage {
+ public:
+  IntegralImage(): num_rows_{0}, num_columns_{0} { }
+
+  // Sets the table to the one of an_image, reusing the buffers of the
+  // previous one. With squares, the sums of the squared pixels are kept
+  // too; they are exact for pixels of up to 16 bits.
+  template <typename PixelType>
+  void Compute(ImageView<const PixelType> an_image, bool squares = false);
+  template <typename PixelType>
+  void Compute(ImageView<PixelType> an_image, bool squares = false) {
+    Compute(ImageView<const PixelType>(an_image), squares);
+  }
+
+  size_t num_rows() const { return num_rows_; }
+  size_t num_columns() const { return num_columns_; }
+
+  // Sum of the pixels of rows [first_row, end_row) and columns
+  // [first_column, end_column).
+  int64_t Sum(size_t first_row, size_t first_column, size_t end_row,
+	      size_t end_column) const {
+    return RectangleSum(sums_, first_row, first_column, end_row, end_column);
+  }
+
+  // Same for the squared pixels; Compute() must have kept them.
+  int64_t SquareSum(size_t first_row, size_t first_column, size_t end_row,
+		    size_t end_column) const {
+    return RectangleSum(square_sums_, first_row, first_column, end_row,
+			end_column);
+  }
+
+ private:
+  int64_t RectangleSum(const std::vector<int64_t> &table, size_t first_row,
+		       size_t first_column, size_t end_row,
+		       size_t end_column) const {
+    const size_t stride = num_columns_ + 1;
+    return table[end_row * stride + end_column] -
+      table[first_row * stride + end_column] -
+      table[end_row * stride + first_column] +
+      table[first_row * stride + first_column];
+  }
+
+  size_t num_rows_;
+  size_t num_columns_;
+  // Entry (i, j), at i * (num_columns_ + 1) + j, is the sum over the
+  // rows before i and the columns before j; row 0 and column 0 are 0.
+  std::vector<int64_t> sums_;
+  std::vector<int64_t> square_sums_;
+};
 
 //  Draws a line of given gray-level color from (x0,y0) to (x1,y1);
 //  an_image is the input/output image. 
-// IMPORTANT: (x0,y0) and (x1,y1) can lie outside the image 
-//   boundaries, so SetPixel() should check the coordinates passed to it.
+// (x0,y0) and (x1,y1) can lie outside the image boundaries: the line is
+//   clipped to the image once, then its pixels are written unchecked.
+//   The pixels drawn are the ones the unclipped line has in the image.
+template <typename PixelType>
 void DrawLine(int x0, int y0, int x1, int y1, int color,
-	      Image *an_image);
+	      Image<PixelType> *an_image);
+
+// Draws many lines of the same color, e.g. all the needles or Hough
+// lines of a frame. lines holds four coordinates per line:
+// {x0, y0, x1, y1, x0, y0, x1, y1, ...}.
+template <typename PixelType>
+void DrawLines(const std::vector<int> &lines, int color,
+	       Image<PixelType> *an_image);
 
 }  // namespace ComputerVisionProjects
 
@@ -5,6 +5,8 @@
 
 #include "image.h"
 #include "image_objects.h"
+#include "labeling.h"
+#include <algorithm>
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -16,90 +18,329 @@
 using namespace std;
 using namespace ComputerVisionProjects;
 
+namespace {
+
 /**
- * gets the labels of connected components in an image
+ * calculates the orientation, the second moments about the axes of least and most inertia and the roundedness
+ * of an object whose a, b and c are known
+ * @param object reference to the object that gets its attributes set
+ */
+void ComputeShape(struct object_data *object){
+  int64_t a = object->a;
+  int64_t b = object->b;
+  int64_t c = object->c;
+  double theta1 = atan2(b, a-c)/2.0;
+  double theta2 = theta1 + (M_PI/2.0);
+  double e_min = a*pow(sin(theta1),2.0) - b*sin(theta1)*cos(theta1) + c*pow(cos(theta1), 2.0);
+  double e_max = a*pow(sin(theta2),2.0) - b*sin(theta2)*cos(theta2) + c*pow(cos(theta2), 2.0);
+  object->orientation = 180*theta1/M_PI;
+  object->e_min = e_min;
+  object->e_max = e_max;
+  object->roundedness = e_min/e_max;
+}
+
+/**
+ * calculates the seven Hu moments of an object from its raw moments
+ * the third order moments are first taken exactly about the rounded down center (x, y),
+ * then moved to the exact center in floating point, by less than a pixel
+ * @param moments the raw moments of the object
+ * @param object reference to the object that gets its Hu moments set, whose x, y, a, b and c are known
+ */
+void ComputeHuMoments(const RawMoments &moments, struct object_data *object){
+  // moments about (x, y), modulo 2^64 for the raw sums; the results are small enough to be exact
+  const uint64_t area = moments.area;
+  const uint64_t x = object->x;
+  const uint64_t y = object->y;
+  const uint64_t m10 = moments.sum_rows;
+  const uint64_t m01 = moments.sum_columns;
+  const uint64_t m20 = moments.sum_rows_squared;
+  const uint64_t m11 = moments.sum_rows_columns;
+  const uint64_t m02 = moments.sum_columns_squared;
+  const int64_t s30 = moments.sum_rows_cubed - 3*x*m20 + 3*x*x*m10 - x*x*x*area;
+  const int64_t s03 = moments.sum_columns_cubed - 3*y*m02 + 3*y*y*m01 - y*y*y*area;
+  const int64_t s21 = moments.sum_rows_squared_columns - y*m20 - 2*x*m11 + 2*x*y*m10 + x*x*m01 - x*x*y*area;
+  const int64_t s12 = moments.sum_rows_columns_squared - x*m02 - 2*y*m11 + 2*x*y*m01 + y*y*m10 - x*y*y*area;
+  const double s20 = object->a;
+  const double s11 = object->b/2.0;
+  const double s02 = object->c;
+
+  // central moments, about the exact center (x + d, y + e)
+  const double a = moments.area;
+  const double d = (moments.sum_rows - object->x*moments.area)/a;
+  const double e = (moments.sum_columns - object->y*moments.area)/a;
+  const double mu20 = s20 - a*d*d;
+  const double mu02 = s02 - a*e*e;
+  const double mu11 = s11 - a*d*e;
+  const double mu30 = s30 - 3*d*s20 + 2*a*d*d*d;
+  const double mu03 = s03 - 3*e*s02 + 2*a*e*e*e;
+  const double mu21 = s21 - e*s20 - 2*d*s11 + 2*a*d*d*e;
+  const double mu12 = s12 - d*s02 - 2*e*s11 + 2*a*d*e*e;
+
+  // normalized so that scaling the object does not change them
+  const double second = a*a;
+  const double third = second*sqrt(a);
+  const double n20 = mu20/second, n02 = mu02/second, n11 = mu11/second;
+  const double n30 = mu30/third, n03 = mu03/third, n21 = mu21/third, n12 = mu12/third;
+  const double p = n30 + n12, q = n21 + n03;
+  object->hu[0] = n20 + n02;
+  object->hu[1] = (n20 - n02)*(n20 - n02) + 4*n11*n11;
+  object->hu[2] = (n30 - 3*n12)*(n30 - 3*n12) + (3*n21 - n03)*(3*n21 - n03);
+  object->hu[3] = p*p + q*q;
+  object->hu[4] = (n30 - 3*n12)*p*(p*p - 3*q*q) + (3*n21 - n03)*q*(3*p*p - q*q);
+  object->hu[5] = (n20 - n02)*(p*p - q*q) + 4*n11*p*q;
+  object->hu[6] = (3*n21 - n03)*p*(p*p - 3*q*q) - (n30 - 3*n12)*q*(3*p*p - q*q);
+  // symmetric objects give -0 as often as 0, adding 0 turns -0 into 0
+  for(double &hu: object->hu){
+    hu += 0.0;
+  }
+}
+
+/**
+ * calculates the gray level a component is drawn in, spread evenly the way p2 does it,
+ * wrapping around the gray levels 1 to 254 past 254 components so white stays free for the orientation lines
+ * @param label the label of the component, 1 to num_components
+ * @param num_components the number of components
+ * @return int32_t the gray level
+ */
+int32_t ComponentGray(int32_t label, int32_t num_components){
+  if (num_components >= 255) return 1 + (label-1) % 254;
+  return label*(255/(num_components+1));
+}
+
+/**
+ * gets the labels of connected components in any image type with a row() accessor
  * @param an_image reference to the image
  * @return set<int> set of all labels of connected components
  */
-set<int> GetLabels(const Image *an_image){
+template <typename LabelImage>
+set<int> CollectLabels(const LabelImage *an_image){
   if (an_image == nullptr) abort();
   set<int> labels;
   size_t rows = an_image->num_rows();
   size_t cols = an_image->num_columns();
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int color = an_image->GetPixel(r,c);
+  for(size_t r = 0; r < rows; r++){
+    const auto *pixels = an_image->row(r);
+    for(size_t c = 0; c < cols; c++){
+      int color = pixels[c];
       if (color != 0) labels.insert(color);
     }
   }
   return labels; 
 }
 
+/**
+ * calculates the attributes of all connected components in a view of any image type
+ * the moments of every label are summed in a table indexed by label, with 64-bit sums, in parallel strips with a pool
+ * @param an_image view of the image
+ * @param pool the threads that sum strips of the image in parallel, or nullptr to sum it on this thread
+ * @return map<int, struct object_data> a map where the connected component label
+ *  is the key and the struct containing the attributes is the value
+ */
+template <typename PixelType>
+map<int, struct object_data> ComputeObjectsData(ImageView<const PixelType> an_image, ThreadPool *pool){
+  MomentTable table;
+  ComputeLabelMoments(an_image, pool, &table);
+
+  map<int, struct object_data> objects;
+  for(size_t label = 1; label < table.size(); label++){
+    if (table.area(label) == 0) continue;
+    object_data object = GetObjectData(label, table.moments(label));
+    // a, b, c and the Hu moments do not depend on where the image starts, the center and bounding box do
+    object.x += an_image.first_row();
+    object.y += an_image.first_column();
+    object.min_x += an_image.first_row();
+    object.max_x += an_image.first_row();
+    object.min_y += an_image.first_column();
+    object.max_y += an_image.first_column();
+    // the labels come in increasing order, so each one goes at the end of the map
+    objects.emplace_hint(objects.end(), label, object);
+  }
+  return objects; 
+}
+
+}  // namespace
+
+/**
+ * gets the labels of connected components in an image
+ * @param an_image reference to the image
+ * @return set<int> set of all labels of connected components
+ */
+set<int> GetLabels(const Image<int32_t> *an_image){
+  return CollectLabels(an_image);
+}
+
+set<int> GetLabels(const MappedImage *an_image){
+  return CollectLabels(an_image);
+}
+
+set<int> GetLabels(ImageView<const int32_t> an_image){
+  return CollectLabels(&an_image);
+}
+
 /**
  * calculates various attributes of all connected components in an image and stores them 
  * @param an_image reference to the image
+ * @param pool the threads that go over strips of the image in parallel, or nullptr to go over it on this thread
  * @return map<int, struct object_data> a map where the connected component label
  *  is the key and the struct containing the attributes is the value
  */
-map<int, struct object_data> GetObjectsData(const Image *an_image){
+map<int, struct object_data> GetObjectsData(const Image<int32_t> *an_image, ThreadPool *pool){
   if (an_image == nullptr) abort();
+  return ComputeObjectsData(an_image->view(), pool);
+}
+
+map<int, struct object_data> GetObjectsData(const MappedImage *an_image, ThreadPool *pool){
+  if (an_image == nullptr) abort();
+  return ComputeObjectsData(an_image->view(), pool);
+}
 
-  set<int> labels = GetLabels(an_image);
+map<int, struct object_data> GetObjectsData(ImageView<const int32_t> an_image, ThreadPool *pool){
+  return ComputeObjectsData(an_image, pool);
+}
+
+/**
+ * calculates the attributes of a connected component from its raw moments
+ * the center is rounded down, and a, b and c are taken about it
+ * @param label the label of the component
+ * @param moments the raw moments of the component
+ * @return struct object_data the attributes of the component
+ */
+struct object_data GetObjectData(int label, const RawMoments &moments){
+  object_data object;
+  object.label = label;
+  object.area = moments.area;
+  // the sums of squares about the center come out of the raw sums, exactly in 64 bits
+  int64_t cx = moments.sum_rows/moments.area;
+  int64_t cy = moments.sum_columns/moments.area;
+  object.x = cx;
+  object.y = cy;
+  object.a = moments.sum_rows_squared - 2*cx*moments.sum_rows + cx*cx*moments.area;
+  object.b = 2*(moments.sum_rows_columns - cy*moments.sum_rows - cx*moments.sum_columns + cx*cy*moments.area);
+  object.c = moments.sum_columns_squared - 2*cy*moments.sum_columns + cy*cy*moments.area;
+  ComputeShape(&object);
+  object.min_x = moments.first_row;
+  object.min_y = moments.first_column;
+  object.max_x = moments.last_row;
+  object.max_y = moments.last_column;
+  object.perimeter = moments.perimeter;
+  ComputeHuMoments(moments, &object);
+  return object;
+}
 
-  // INSTANTIATE MAP AND POPULATE
+/**
+ * calculates the attributes of connected components from their raw moments
+ * @param moments the raw moments of components 1, 2, ... (entry 0 is unused)
+ * @param labels the label of each component in the map, indexed like moments
+ * @return map<int, struct object_data> a map where the connected component label
+ *  is the key and the struct containing the attributes is the value
+ */
+map<int, struct object_data> GetObjectsData(const vector<RawMoments> &moments, const vector<int32_t> &labels){
+  if (labels.size() != moments.size()) abort();
   map<int, struct object_data> objects;
-  for(const int& label: labels){
-    object_data object;
-    objects[label] = object;
+  for(size_t component = 1; component < moments.size(); component++){
+    objects[labels[component]] = GetObjectData(labels[component], moments[component]);
   }
+  return objects;
+}
 
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
-  
-  // FIRST PASS: GET CENTERS AND AREAS
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int color = an_image->GetPixel(r,c);
-      if (color != 0){
-        objects[color].area += 1;
-        objects[color].x += r;
-        objects[color].y += c;
+/**
+ * Labels the 8-connected components of a binary image and calculates their attributes in the same pass
+ * @param input_file the binary image (.pgm, or .pbm made by p1)
+ * @param pool the threads that label strips of a .pgm image in parallel, or nullptr to label it on this thread
+ * @param an_image reference to the image the orientation lines get drawn on, labeled as p2 would
+ * @param objects reference to the map that receives the attributes of the connected components
+ * @return bool true if the image was read successfully
+ */
+bool LabelObjects(const string &input_file, ThreadPool *pool, Image<int32_t> *an_image, map<int, struct object_data> *objects){
+  vector<RawMoments> moments;
+  size_t num_components;
+  vector<int32_t> grays;
+  if (IsPbmFilename(input_file)) {
+    // the runs are labeled, and their moments summed in closed form
+    BinaryImage binary_image;
+    if (!ReadBinaryImage(input_file, &binary_image)) return false;
+    RunLengthImage runs;
+    EncodeRuns(binary_image, &runs);
+    vector<int32_t> run_labels;
+    num_components = LabelRuns<8>(runs, &run_labels, &moments);
+    grays.resize(num_components+1);
+    for(size_t label = 1; label <= num_components; label++){
+      grays[label] = ComponentGray(label, num_components);
+    }
+    an_image->AllocateSpaceAndSetSize(runs.num_rows(), runs.num_columns());
+    size_t k = 0;
+    for(size_t r = 0; r < runs.num_rows(); r++){
+      int32_t *pixels = an_image->row(r);
+      for(const RunLengthImage::Run *run = runs.row(r); run != runs.row_end(r); ++run, ++k){
+        fill(pixels + run->first_column, pixels + run->end_column, grays[run_labels[k]]);
       }
     }
+  } else {
+    if (!ReadImage(input_file, an_image)) return false;
+    ComponentLabeler<8> labeler;
+    num_components = labeler.Label(an_image, pool, &moments);
+    grays.resize(num_components+1);
+    for(size_t label = 1; label <= num_components; label++){
+      grays[label] = ComponentGray(label, num_components);
+    }
+    // only the drawing needs the second pass, the attributes are already known
+    labeler.Relabel(grays, an_image, pool);
   }
-  for(const int& label: labels){
-    objects[label].x = objects[label].x/objects[label].area;
-    objects[label].y = objects[label].y/objects[label].area;
+  an_image->SetNumberGrayLevels(255);
+
+  // the objects are stored under the gray level p2 would give them
+  vector<int32_t> labels(num_components+1, 0);
+  int step = max<int>(255/(num_components+1), 1);
+  for(size_t label = 1; label <= num_components; label++){
+    labels[label] = label*step;
   }
+  *objects = GetObjectsData(moments, labels);
+  return true;
+}
 
-  // SECOND PASS: GET A'S B'S AND C'S
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int color = an_image->GetPixel(r,c);
-      if (color != 0){
-        int cx = objects[color].x;
-        int cy = objects[color].y;
-        objects[color].a += pow(r-cx, 2);
-        objects[color].b += 2*(r-cx)*(c-cy);
-        objects[color].c += pow(c-cy, 2);
-      }
+/**
+ * Reads a labeled image and calculates the attributes of its connected components
+ * @param input_file the labeled image (.pgm or .lbl), or a binary image (.pbm, or .pgm when binary is true)
+ * @param binary true if a .pgm input_file is a binary image whose components are labeled here
+ * @param pool the threads that label a binary image, or nullptr to label it on this thread
+ * @param an_image reference to the image the orientation lines get drawn on, a gray level copy of the labeled image
+ * @param objects reference to the map that receives the attributes of the connected components
+ * @return bool true if the image was read successfully
+ */
+bool ReadObjects(const string &input_file, bool binary, ThreadPool *pool, Image<int32_t> *an_image, map<int, struct object_data> *objects){
+  if (an_image == nullptr || objects == nullptr) abort();
+  if (binary || IsPbmFilename(input_file)) return LabelObjects(input_file, pool, an_image, objects);
+  if (IsLabelFilename(input_file)) {
+    if (!ReadLabelImage(input_file, an_image)) return false;
+  } else {
+    size_t rows, cols, levels;
+    if (!ReadImageHeader(input_file, &rows, &cols, &levels)) return false;
+    if (levels <= 255) {
+      // the attributes are computed straight from the mapped file,
+      // an_image is only a copy to draw the orientation lines on
+      MappedImage labeled_image;
+      if (!MapImage(input_file, &labeled_image)) return false;
+      CopyImage(labeled_image, an_image);
+      *objects = GetObjectsData(&labeled_image, pool);
+      return true;
     }
+    // past 254 components p2 writes a 16-bit .pgm whose gray levels are the labels themselves
+    if (!ReadImage(input_file, an_image)) return false;
   }
 
-  for(const int& label: labels){
-    int a = objects[label].a;
-    int b = objects[label].b;
-    int c = objects[label].c;
-    double theta1 = atan2(b, a-c)/2.0;
-    double theta2 = theta1 + (M_PI/2.0);
-    double e_min = a*pow(sin(theta1),2.0) - b*sin(theta1)*cos(theta1) + c*pow(cos(theta1), 2.0);
-    double e_max = a*pow(sin(theta2),2.0) - b*sin(theta2)*cos(theta2) + c*pow(cos(theta2), 2.0);
-    objects[label].orientation = 180*theta1/M_PI;
-    objects[label].e_min = e_min;
-    objects[label].e_max = e_max;
-    objects[label].roundedness = e_min/e_max;
+  // the labels are read into an_image, and turned into gray levels in place once the attributes are computed
+  *objects = GetObjectsData(an_image, pool);
+  int32_t largest = an_image->num_gray_levels();
+  size_t rows = an_image->num_rows();
+  size_t cols = an_image->num_columns();
+  for(size_t r = 0; r < rows; r++){
+    int32_t *pixels = an_image->row(r);
+    for(size_t c = 0; c < cols; c++){
+      if (pixels[c] != 0) pixels[c] = ComponentGray(pixels[c], largest);
+    }
   }
-  return objects; 
+  an_image->SetNumberGrayLevels(255);
+  return true;
 }
 
 /**
@@ -108,9 +349,9 @@ map<int, struct object_data> GetObjectsData(const Image *an_image){
  * @param x the center x value of dot
  * @param y the center y value of dot
  */
-void DrawDot(Image *an_image, int x, int y){
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
+void DrawDot(Image<int32_t> *an_image, int x, int y){
+  int rows = static_cast<int>(an_image->num_rows());
+  int cols = static_cast<int>(an_image->num_columns());
   an_image->SetPixel(x,y, 255);
   if(y-1 >= 0) an_image->SetPixel(x,y-1, 255);
   if(x-1 >= 0) an_image->SetPixel(x-1,y, 255);
@@ -128,18 +369,14 @@ void DrawDot(Image *an_image, int x, int y){
  * @param an_image reference to the image that gets modified
  * @param object a struct containing all the object attributes
  */
-void DrawOrientation(Image *an_image, struct object_data object){
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
-
+void DrawOrientation(Image<int32_t> *an_image, struct object_data object){
   int cx = object.x;
   int cy = object.y;
   double theta1 = object.orientation*M_PI/180;
   DrawDot(an_image, cx, cy);
   
+  // DrawLine clips the line to the image, so it may run past any edge
   int lx = cx+30*cos(theta1);
   int ly = cy+30*sin(theta1);
-  if(lx <= rows && ly <= cols){
-    DrawLine(cx, cy, lx, ly, 255, an_image);
-  }
+  DrawLine(cx, cy, lx, ly, 255, an_image);
 }
@@ -6,6 +6,8 @@
 #ifndef IMAGE_OBJECTS_H
 #define IMAGE_OBJECTS_H
 #include "image.h"
+#include "batch.h"
+#include "labeling.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -13,24 +15,35 @@
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
 
 using namespace std;
 using namespace ComputerVisionProjects;
 
 // contains necessary attributes of object
 struct object_data{
-  object_data(): area(0), x(0), y(0), a(0), b(0), c(0) {}
+  object_data(): area(0), x(0), y(0), a(0), b(0), c(0), min_x(0), min_y(0), max_x(0), max_y(0), perimeter(0), hu() {}
   int label;
   int area;
   int x;
   int y;
-  int a;
-  int b;
-  int c;
+  // second moments about the center, in 64 bits so large objects do not overflow
+  int64_t a;
+  int64_t b;
+  int64_t c;
   double orientation;
   double e_min;
   double e_max;
   double roundedness;
+  // bounding box, rows min_x to max_x and columns min_y to max_y included
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+  // number of pixel sides between the object and the rest of the image
+  int64_t perimeter;
+  // the seven Hu moments, which do not change when the object is shifted, scaled or rotated
+  double hu[7];
 };
 
 /**
@@ -38,15 +51,58 @@ struct object_data{
  * @param an_image reference to the image
  * @return set<int> set of all labels of connected components
  */
-set<int> GetLabels(const Image *an_image);
+set<int> GetLabels(const Image<int32_t> *an_image);
+set<int> GetLabels(const MappedImage *an_image);
+set<int> GetLabels(ImageView<const int32_t> an_image);
 
 /**
  * calculates various attributes of all connected components in an image and stores them 
+ * the labels are the positive pixel values, every other value is background
+ * for a view of a region of the image the centers are given in the coordinates of the full image
  * @param an_image reference to the image
+ * @param pool the threads that go over strips of the image in parallel, or nullptr to go over it on this thread
  * @return map<int, struct object_data> a map where the connected component label
  *  is the key and the struct containing the attributes is the value
  */
-map<int, struct object_data> GetObjectsData(const Image *an_image);
+map<int, struct object_data> GetObjectsData(const Image<int32_t> *an_image, ThreadPool *pool = nullptr);
+map<int, struct object_data> GetObjectsData(const MappedImage *an_image, ThreadPool *pool = nullptr);
+map<int, struct object_data> GetObjectsData(ImageView<const int32_t> an_image, ThreadPool *pool = nullptr);
+
+/**
+ * calculates the attributes of a connected component from its raw moments, e.g. accumulated while labeling it,
+ * so that its pixels are not gone over again; the results are the same as from its pixels
+ * the bounding box and perimeter are copied, and the Hu moments come from the central moments up to the third order
+ * @param label the label of the component
+ * @param moments the raw moments of the component
+ * @return struct object_data the attributes of the component
+ */
+struct object_data GetObjectData(int label, const RawMoments &moments);
+
+/**
+ * calculates the attributes of connected components from their raw moments
+ * @param moments the raw moments of components 1, 2, ... (entry 0 is unused)
+ * @param labels the label of each component in the map, indexed like moments
+ * @return map<int, struct object_data> a map where the connected component label
+ *  is the key and the struct containing the attributes is the value
+ */
+map<int, struct object_data> GetObjectsData(const vector<RawMoments> &moments, const vector<int32_t> &labels);
+
+/**
+ * Reads a labeled image and calculates the attributes of its connected components
+ * the image is either a .pgm image made by p2, mapped into memory (or read whole when p2 wrote it
+ * with 16 bits per pixel, past 254 objects), or a 32-bit .lbl label image
+ * the labels of a 16-bit .pgm or .lbl image are turned into gray levels the way p2 spreads them when there are fewer
+ * than 255 objects, and wrap around the gray levels 1 to 254 otherwise, so white stays free for the lines
+ * a binary image (.pbm, or .pgm when binary is true) is labeled as p2 would, and the attributes of its
+ * components are accumulated during the labeling scan itself, so the image is read only once
+ * @param input_file the labeled or binary image
+ * @param binary true if a .pgm input_file is a binary image whose components are labeled here
+ * @param pool the threads that label a binary image or go over a labeled one, or nullptr to stay on this thread
+ * @param an_image reference to the image the orientation lines get drawn on, a gray level copy of the labeled image
+ * @param objects reference to the map that receives the attributes of the connected components
+ * @return bool true if the image was read successfully
+ */
+bool ReadObjects(const string &input_file, bool binary, ThreadPool *pool, Image<int32_t> *an_image, map<int, struct object_data> *objects);
 
 /**
  * Draws a 3 pixel by 3 pixel dot given a pair of coordinates 
@@ -54,7 +110,7 @@ map<int, struct object_data> GetObjectsData(const Image *an_image);
  * @param x the center x value of dot
  * @param y the center y value of dot
  */
-void DrawDot(Image *an_image, int x, int y);
+void DrawDot(Image<int32_t> *an_image, int x, int y);
 
 /**
  * Draws the orientation line of a connected component(object) starting from its center
@@ -62,6 +118,6 @@ void DrawDot(Image *an_image, int x, int y);
  * @param an_image reference to the image that gets modified
  * @param object a struct containing all the object attributes
  */
-void DrawOrientation(Image *an_image, struct object_data obj);
+void DrawOrientation(Image<int32_t> *an_image, struct object_data obj);
 
 #endif
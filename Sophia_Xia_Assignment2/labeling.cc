@@ -0,0 +1,710 @@
+// Labeling of the connected components of binary images.
+
+#include "labeling.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+using namespace std;
+
+namespace ComputerVisionProjects {
+
+namespace {
+
+// Value of the foreground pixels of a binary image.
+const int32_t kForeground = 255;
+
+// Rows labeled by one strip at least, enough to be worth handing to a
+// worker.
+const size_t kMinStripPixels = 1 << 16;
+
+// Sums of the integers, of their squares and of their cubes below n; the
+// cubes modulo 2^64.
+inline int64_t SumBelow(int64_t n) { return n * (n - 1) / 2; }
+inline int64_t SumSquaresBelow(int64_t n) {
+  return (n - 1) * n * (2 * n - 1) / 6;
+}
+inline uint64_t SumCubesBelow(int64_t n) {
+  const uint64_t sum = SumBelow(n);
+  return sum * sum;
+}
+
+// Returns the raw moments of the pixels of columns [first_column,
+// end_column) of row, from the closed forms above. Both
+// RawMoments::AddRun() and MomentTable::AddRun() add them up.
+RawMoments RunMoments(int64_t row, int64_t first_column, int64_t end_column) {
+  const int64_t length = end_column - first_column;
+  const int64_t columns = SumBelow(end_column) - SumBelow(first_column);
+  const int64_t columns_squared =
+    SumSquaresBelow(end_column) - SumSquaresBelow(first_column);
+  const uint64_t r = row;
+  RawMoments run;
+  run.area = length;
+  run.sum_rows = row * length;
+  run.sum_columns = columns;
+  run.sum_rows_squared = row * row * length;
+  run.sum_rows_columns = row * columns;
+  run.sum_columns_squared = columns_squared;
+  run.sum_rows_cubed = r * r * r * length;
+  run.sum_rows_squared_columns = r * r * columns;
+  run.sum_rows_columns_squared = r * columns_squared;
+  run.sum_columns_cubed =
+    SumCubesBelow(end_column) - SumCubesBelow(first_column);
+  run.perimeter = 2 * length + 2;
+  run.first_row = row;
+  run.last_row = row;
+  run.first_column = first_column;
+  run.last_column = end_column - 1;
+  return run;
+}
+
+// In 2x2 blocks
+//   p q q r r
+//   s x y
+//   s z w
+// the foreground pixels of block x y z w are 8-connected and take one
+// label. The block is connected to the upper left block if p and x are
+// foreground, to the upper one if some q and x or y are, to the upper
+// right one if r and y are, and to the left one if some s and x or z are.
+// Bits of the index of the action of a block: the connected neighbor
+// blocks, then the pixels that tell which of them are already merged.
+enum BlockBit {
+  kUpperLeft = 1,
+  kUpper = 2,
+  kUpperRight = 4,
+  kLeft = 8,
+  kUpperFirst = 16,   // The left q.
+  kUpperSecond = 32,  // The right q.
+  kLeftFirst = 64,    // The upper s.
+  kNumBlockCases = 128
+};
+
+// The neighbor block whose label a block takes, and the others merged
+// with it.
+struct BlockAction {
+  uint8_t take;
+  uint8_t merge;
+};
+
+// The action of every case, worked out once. Neighbor blocks that touch
+// each other were merged when the later of them was labeled, and are not
+// merged again: the left q touches p and the upper s, and the right q
+// touches r.
+class BlockActionTable {
+ public:
+  BlockActionTable() {
+    for (int index = 0; index < kNumBlockCases; ++index) {
+      int merge = index & (kUpperLeft | kUpper | kUpperRight | kLeft);
+      const bool upper_first = (merge & kUpper) && (index & kUpperFirst);
+      const bool upper_second = (merge & kUpper) && (index & kUpperSecond);
+      const bool left_first = (merge & kLeft) && (index & kLeftFirst);
+      if (upper_first) merge &= ~kUpperLeft;
+      if (upper_second) merge &= ~kUpperRight;
+      if (left_first && (upper_first || (index & kUpperLeft)))
+	merge &= ~kLeft;
+      BlockAction &action = actions_[index];
+      action.take = 0;
+      for (const int neighbor : {kUpper, kUpperLeft, kUpperRight, kLeft}) {
+	if (merge & neighbor) {
+	  action.take = neighbor;
+	  break;
+	}
+      }
+      action.merge = merge & ~action.take;
+    }
+  }
+
+  const BlockAction &operator[](int index) const { return actions_[index]; }
+
+ private:
+  BlockAction actions_[kNumBlockCases];
+};
+
+// Replaces the pixels of rows [first_row, end_row) of an_image by
+// provisional labels of equivalences, as if the image started at
+// first_row. Where the labels are not handed out in raster order, sets
+// first_pixels[label] to the raster index, within the rows, of the first
+// pixel of every label. Unless moments is nullptr, sets (*moments)[label]
+// to the raw moments of the pixels given every label, in the coordinates
+// of the image.
+template <int kConnectivity>
+void LabelRows(size_t first_row, size_t end_row, Image<int32_t> *an_image,
+	       UnionFind *equivalences, vector<size_t> *first_pixels,
+	       vector<RawMoments> *moments);
+
+// Pixel by pixel: the neighbors of a pixel are the ones above and to the
+// left, and the labels are handed out in raster order.
+template <>
+void LabelRows<4>(size_t first_row, size_t end_row, Image<int32_t> *an_image,
+		  UnionFind *equivalences, vector<size_t> *first_pixels,
+		  vector<RawMoments> *moments) {
+  const size_t num_columns = an_image->num_columns();
+  first_pixels->clear();
+  if (moments != nullptr) moments->assign(1, RawMoments());
+  for (size_t i = first_row; i < end_row; ++i) {
+    int32_t *pixels = an_image->row(i);
+    const int32_t *above = (i > first_row) ? an_image->row(i - 1) : nullptr;
+    for (size_t j = 0; j < num_columns; ++j) {
+      if (pixels[j] != kForeground) {
+	pixels[j] = 0;
+	continue;
+      }
+      const int32_t upper = (above != nullptr) ? above[j] : 0;
+      const int32_t left = (j > 0) ? pixels[j - 1] : 0;
+      if (upper != 0) {
+	pixels[j] = upper;
+	if (left != 0 && left != upper) equivalences->Union(upper, left);
+      } else if (left != 0) {
+	pixels[j] = left;
+      } else {
+	pixels[j] = equivalences->NewLabel();
+	if (moments != nullptr) moments->push_back(RawMoments());
+      }
+      if (moments != nullptr) {
+	RawMoments &pixel_moments = (*moments)[pixels[j]];
+	pixel_moments.Add(i, j);
+	pixel_moments.AddSharedEdges((upper != 0) + (left != 0));
+      }
+    }
+  }
+}
+
+// Labels the block of columns j and j + 1 of rows top and bottom, in 2x2
+// blocks as above, and keeps first_pixels and moments (unless nullptr) up
+// to date; top_index is the raster index of top[0] within the strip, and
+// top_row the row of top in the image.
+// Pixels outside the image are read only where has_left, has_right and
+// has_upper_right allow; the middle of the rows passes true for all
+// three, so that the reads need no tests there.
+inline __attribute__((always_inline))
+void LabelBlock(const BlockActionTable &actions, const int32_t *above,
+		       int32_t *top, int32_t *bottom, size_t j,
+		       bool has_left, bool has_right, bool has_upper_right,
+		       size_t top_index, size_t num_columns, int64_t top_row,
+		       UnionFind *equivalences, vector<size_t> *first_pixels,
+		       vector<RawMoments> *moments) {
+  const bool x = top[j] == kForeground;
+  const bool y = has_right && top[j + 1] == kForeground;
+  const bool z = bottom[j] == kForeground;
+  const bool w = has_right && bottom[j + 1] == kForeground;
+  if (!(x || y || z || w)) {
+    top[j] = 0;
+    bottom[j] = 0;
+    if (has_right) {
+      top[j + 1] = 0;
+      bottom[j + 1] = 0;
+    }
+    return;
+  }
+  const int32_t p = has_left ? above[j - 1] : 0;
+  const int32_t upper_first = above[j];
+  const int32_t upper_second = has_right ? above[j + 1] : 0;
+  const int32_t r = has_upper_right ? above[j + 2] : 0;
+  const int32_t left_first = has_left ? top[j - 1] : 0;
+  const int32_t left_second = has_left ? bottom[j - 1] : 0;
+  // Labels of the neighbor blocks, by bit, 0 where no pixel connects them.
+  int32_t neighbors[kLeft + 1];
+  neighbors[kUpperLeft] = x ? p : 0;
+  neighbors[kUpper] = !(x || y) ? 0 :
+    (upper_first != 0) ? upper_first : upper_second;
+  neighbors[kUpperRight] = y ? r : 0;
+  neighbors[kLeft] = !(x || z) ? 0 :
+    (left_first != 0) ? left_first : left_second;
+  const int index = (neighbors[kUpperLeft] != 0) * kUpperLeft |
+    (neighbors[kUpper] != 0) * kUpper |
+    (neighbors[kUpperRight] != 0) * kUpperRight |
+    (neighbors[kLeft] != 0) * kLeft |
+    (upper_first != 0) * kUpperFirst | (upper_second != 0) * kUpperSecond |
+    (left_first != 0) * kLeftFirst;
+  const BlockAction &action = actions[index];
+  const size_t first_pixel = x ? top_index + j :
+    y ? top_index + j + 1 :
+    z ? top_index + num_columns + j : top_index + num_columns + j + 1;
+  int32_t label;
+  if (action.take == 0) {
+    label = equivalences->NewLabel();
+    first_pixels->push_back(first_pixel);
+    if (moments != nullptr) moments->push_back(RawMoments());
+  } else {
+    label = neighbors[action.take];
+    for (int merge = action.merge; merge != 0; merge &= merge - 1) {
+      const int32_t other = neighbors[merge & -merge];
+      if (other != label) equivalences->Union(label, other);
+    }
+    // The label of an upper block starts on an earlier row, but a block
+    // to the left may start on the row below.
+    if (action.take == kLeft && first_pixel < (*first_pixels)[label])
+      (*first_pixels)[label] = first_pixel;
+  }
+  if (moments != nullptr) {
+    RawMoments &block_moments = (*moments)[label];
+    if (x) block_moments.Add(top_row, j);
+    if (y) block_moments.Add(top_row, j + 1);
+    if (z) block_moments.Add(top_row + 1, j);
+    if (w) block_moments.Add(top_row + 1, j + 1);
+    // The 4-neighbors within the block, to the left and above.
+    block_moments.AddSharedEdges((x && y) + (z && w) + (x && z) + (y && w) +
+				 (x && left_first != 0) +
+				 (z && left_second != 0) +
+				 (x && upper_first != 0) +
+				 (y && upper_second != 0));
+  }
+  top[j] = x ? label : 0;
+  bottom[j] = z ? label : 0;
+  if (has_right) {
+    top[j + 1] = y ? label : 0;
+    bottom[j + 1] = w ? label : 0;
+  }
+}
+
+// In 2x2 blocks, as above.
+template <>
+void LabelRows<8>(size_t first_row, size_t end_row, Image<int32_t> *an_image,
+		  UnionFind *equivalences, vector<size_t> *first_pixels,
+		  vector<RawMoments> *moments) {
+  static const BlockActionTable kBlockActions;
+  const size_t num_columns = an_image->num_columns();
+  first_pixels->assign(1, 0);
+  if (moments != nullptr) moments->assign(1, RawMoments());
+  // Stands for the rows outside the strip, which are background: the
+  // missing row below a last odd row is only ever given 0.
+  vector<int32_t> background(num_columns, 0);
+  for (size_t i = first_row; i < end_row; i += 2) {
+    int32_t *top = an_image->row(i);
+    int32_t *bottom = (i + 1 < end_row) ? an_image->row(i + 1) :
+      background.data();
+    const int32_t *above = (i > first_row) ? an_image->row(i - 1) :
+      background.data();
+    const size_t top_index = (i - first_row) * num_columns;
+    for (size_t j = 0; j < num_columns; j += 2) {
+      if (j > 0 && j + 2 < num_columns) {
+	LabelBlock(kBlockActions, above, top, bottom, j, true, true, true,
+		   top_index, num_columns, i, equivalences, first_pixels, moments);
+      } else {
+	LabelBlock(kBlockActions, above, top, bottom, j, j > 0,
+		   j + 1 < num_columns, j + 2 < num_columns, top_index,
+		   num_columns, i, equivalences, first_pixels, moments);
+      }
+    }
+  }
+}
+
+// Renumbers the components of rows labeled in 2x2 blocks, numbered in
+// the order of their smallest labels (that of the blocks), in the order
+// of their first pixels. A component is first met in the row pair of its
+// smallest label, so only the components of a row pair may move: those
+// met on its upper row go first, and among these and among those met on
+// its lower row the block order is seldom not the column order.
+void SortComponents(const vector<size_t> &first_pixels, size_t num_columns,
+		    size_t num_components, vector<int32_t> *components) {
+  vector<size_t> component_pixels(num_components + 1, SIZE_MAX);
+  for (size_t label = 1; label < components->size(); ++label) {
+    size_t &first_pixel = component_pixels[(*components)[label]];
+    first_pixel = min(first_pixel, first_pixels[label]);
+  }
+  if (is_sorted(component_pixels.begin() + 1, component_pixels.end())) return;
+  auto by_first_pixel = [&](int32_t a, int32_t b) {
+    return component_pixels[a] < component_pixels[b];
+  };
+  auto on_upper_row = [&](int32_t component) {
+    return component_pixels[component] / num_columns % 2 == 0;
+  };
+  vector<int32_t> order(num_components);
+  for (size_t k = 0; k < num_components; ++k) order[k] = k + 1;
+  for (auto first = order.begin(); first != order.end();) {
+    const size_t row_pair = component_pixels[*first] / (2 * num_columns);
+    auto end = first + 1;
+    while (end != order.end() &&
+	   component_pixels[*end] / (2 * num_columns) == row_pair)
+      ++end;
+    if (!is_sorted(first, end, by_first_pixel)) {
+      auto middle = stable_partition(first, end, on_upper_row);
+      if (!is_sorted(first, middle, by_first_pixel))
+	sort(first, middle, by_first_pixel);
+      if (!is_sorted(middle, end, by_first_pixel))
+	sort(middle, end, by_first_pixel);
+    }
+    first = end;
+  }
+  vector<int32_t> numbers(num_components + 1, 0);
+  for (size_t k = 0; k < num_components; ++k) numbers[order[k]] = k + 1;
+  for (int32_t &component : *components) component = numbers[component];
+}
+
+}  // namespace
+
+void UnionFind::Reset(size_t expected_labels) {
+  parents_.clear();
+  ranks_.clear();
+  parents_.reserve(expected_labels + 1);
+  ranks_.reserve(expected_labels + 1);
+  // Label 0 is the background.
+  parents_.push_back(0);
+  ranks_.push_back(0);
+}
+
+int32_t UnionFind::Union(int32_t a, int32_t b) {
+  a = Find(a);
+  b = Find(b);
+  if (a == b) return a;
+  // The shorter tree goes under the taller one.
+  if (ranks_[a] < ranks_[b]) swap(a, b);
+  parents_[b] = a;
+  if (ranks_[a] == ranks_[b]) ++ranks_[a];
+  return a;
+}
+
+size_t UnionFind::Flatten(vector<int32_t> *final_labels) {
+  if (final_labels == nullptr) abort();
+  final_labels->assign(parents_.size(), 0);
+  int32_t num_sets = 0;
+  // The smallest label of a set is met before any other of its labels,
+  // so its representative is numbered at that point.
+  for (size_t label = 1; label < parents_.size(); ++label) {
+    const int32_t root = Find(label);
+    if ((*final_labels)[root] == 0) (*final_labels)[root] = ++num_sets;
+    (*final_labels)[label] = (*final_labels)[root];
+  }
+  return num_sets;
+}
+
+template <int kConnectivity>
+size_t ComponentLabeler<kConnectivity>::Label(Image<int32_t> *an_image,
+					      ThreadPool *pool,
+					      vector<RawMoments> *moments) {
+  if (an_image == nullptr) abort();
+  const size_t num_rows = an_image->num_rows();
+  const size_t num_columns = max<size_t>(an_image->num_columns(), 1);
+  const size_t num_strips = (pool == nullptr) ? 1 :
+    max<size_t>(1, min(pool->num_threads(),
+		       num_rows * num_columns / kMinStripPixels));
+  strips_.resize(num_strips);
+  for (size_t s = 0; s < num_strips; ++s) {
+    strips_[s].first_row = num_rows * s / num_strips;
+    strips_[s].end_row = num_rows * (s + 1) / num_strips;
+  }
+  // The strips are labeled on their own, and their components numbered
+  // in the order they are met, as for the whole image.
+  auto label_strip = [&](size_t s, size_t) {
+    Strip &strip = strips_[s];
+    strip.equivalences.Reset((strip.end_row - strip.first_row) *
+			     num_columns / 64);
+    LabelRows<kConnectivity>(strip.first_row, strip.end_row, an_image,
+			     &strip.equivalences, &strip.first_pixels,
+			     (moments != nullptr) ? &strip.moments : nullptr);
+    const size_t num_strip_components =
+      strip.equivalences.Flatten(&strip.components);
+    if (!strip.first_pixels.empty())
+      SortComponents(strip.first_pixels, num_columns, num_strip_components,
+		     &strip.components);
+    return true;
+  };
+  if (num_strips == 1) label_strip(0, 0);
+  else pool->ForEach(num_strips, label_strip);
+
+  // The components of the strips, one after the other, keep the order
+  // in which a raster scan meets them.
+  merged_.Reset();
+  for (Strip &strip : strips_) {
+    strip.first_label = merged_.num_labels();
+    const int32_t num_strip_components =
+      *max_element(strip.components.begin(), strip.components.end());
+    for (int32_t k = 0; k < num_strip_components; ++k) merged_.NewLabel();
+  }
+  // Pixels on both sides of a boundary are 4-neighbors if they are in the
+  // same column, 8-neighbors if their columns differ by at most 1.
+  const size_t reach = (kConnectivity == 8) ? 1 : 0;
+  for (size_t s = 1; s < num_strips; ++s) {
+    const Strip &above_strip = strips_[s - 1];
+    const Strip &strip = strips_[s];
+    if (strip.first_row == strip.end_row ||
+	above_strip.first_row == above_strip.end_row) continue;
+    const int32_t *above = an_image->row(strip.first_row - 1);
+    const int32_t *pixels = an_image->row(strip.first_row);
+    for (size_t j = 0; j < an_image->num_columns(); ++j) {
+      if (pixels[j] == 0) continue;
+      const int32_t label = strip.first_label + strip.components[pixels[j]];
+      const size_t first = (j >= reach) ? j - reach : 0;
+      const size_t last = min(j + reach, an_image->num_columns() - 1);
+      for (size_t k = first; k <= last; ++k)
+	if (above[k] != 0)
+	  merged_.Union(label,
+			above_strip.first_label + above_strip.components[above[k]]);
+    }
+  }
+  num_components_ = merged_.Flatten(&final_labels_);
+
+  // The moments of the provisional labels add up to those of their
+  // components, but for the 4-neighbors across the strip boundaries, each
+  // strip having been labeled as if the rows above it were background.
+  if (moments != nullptr) {
+    moments->assign(num_components_ + 1, RawMoments());
+    for (const Strip &strip : strips_)
+      for (size_t label = 1; label < strip.moments.size(); ++label)
+	(*moments)[final_labels_[strip.first_label + strip.components[label]]]
+	  .Add(strip.moments[label]);
+    for (size_t s = 1; s < num_strips; ++s) {
+      const Strip &strip = strips_[s];
+      if (strip.first_row == strip.end_row || strip.first_row == 0) continue;
+      const int32_t *above = an_image->row(strip.first_row - 1);
+      const int32_t *pixels = an_image->row(strip.first_row);
+      for (size_t j = 0; j < an_image->num_columns(); ++j)
+	if (pixels[j] != 0 && above[j] != 0)
+	  (*moments)[final_labels_[strip.first_label +
+				   strip.components[pixels[j]]]]
+	    .AddSharedEdges(1);
+    }
+  }
+  return num_components_;
+}
+
+template <int kConnectivity>
+void ComponentLabeler<kConnectivity>::Relabel(const vector<int32_t> &colors,
+					      Image<int32_t> *an_image,
+					      ThreadPool *pool) {
+  if (an_image == nullptr || colors.size() != num_components_ + 1) abort();
+  const size_t num_columns = an_image->num_columns();
+  auto relabel_strip = [&](size_t s, size_t) {
+    const Strip &strip = strips_[s];
+    // The color of every provisional label of the strip, looked up once.
+    vector<int32_t> label_colors(strip.components.size());
+    for (size_t label = 0; label < label_colors.size(); ++label)
+      label_colors[label] = (label == 0) ? colors[0] :
+	colors[final_labels_[strip.first_label + strip.components[label]]];
+    for (size_t i = strip.first_row; i < strip.end_row; ++i) {
+      int32_t *pixels = an_image->row(i);
+      for (size_t j = 0; j < num_columns; ++j)
+	pixels[j] = label_colors[pixels[j]];
+    }
+    return true;
+  };
+  if (pool == nullptr || strips_.size() == 1) {
+    for (size_t s = 0; s < strips_.size(); ++s) relabel_strip(s, 0);
+  } else {
+    pool->ForEach(strips_.size(), relabel_strip);
+  }
+}
+
+template class ComponentLabeler<4>;
+template class ComponentLabeler<8>;
+
+template <int kConnectivity>
+size_t LabelRuns(const RunLengthImage &runs, vector<int32_t> *run_labels,
+		 vector<RawMoments> *moments) {
+  if (run_labels == nullptr) abort();
+  typedef RunLengthImage::Run Run;
+  // Runs of consecutive rows touch if the columns of their ends overlap
+  // once widened by reach.
+  const int32_t reach = (kConnectivity == 8) ? 1 : 0;
+  const Run *const first_run = runs.runs().data();
+  UnionFind equivalences(runs.num_runs() / 4);
+  // Labels are handed out to the runs that touch none above, in raster
+  // order.
+  vector<int32_t> labels(runs.num_runs());
+  // Raw moments of every provisional label, if asked for.
+  vector<RawMoments> label_moments(moments != nullptr ? 1 : 0);
+  for (size_t i = 0; i < runs.num_rows(); ++i) {
+    const Run *above = (i > 0) ? runs.row(i - 1) : nullptr;
+    const Run *above_end = (i > 0) ? runs.row_end(i - 1) : nullptr;
+    for (const Run *run = runs.row(i); run != runs.row_end(i); ++run) {
+      // The runs above that end before this run cannot touch the next
+      // ones either.
+      while (above != above_end &&
+	     above->end_column + reach <= run->first_column)
+	++above;
+      int32_t label = 0;
+      // Columns the run shares with the runs above.
+      int64_t shared_columns = 0;
+      for (const Run *other = above;
+	   other != above_end && other->first_column < run->end_column + reach;
+	   ++other) {
+	const int32_t other_label = labels[other - first_run];
+	if (label == 0) label = other_label;
+	else if (other_label != label) equivalences.Union(label, other_label);
+	shared_columns += max(0, min(other->end_column, run->end_column) -
+			      max(other->first_column, run->first_column));
+      }
+      if (label == 0) {
+	label = equivalences.NewLabel();
+	if (moments != nullptr) label_moments.push_back(RawMoments());
+      }
+      labels[run - first_run] = label;
+      if (moments != nullptr) {
+	label_moments[label].AddRun(i, run->first_column, run->end_column);
+	label_moments[label].AddSharedEdges(shared_columns);
+      }
+    }
+  }
+  vector<int32_t> components;
+  const size_t num_components = equivalences.Flatten(&components);
+  run_labels->resize(labels.size());
+  for (size_t k = 0; k < labels.size(); ++k)
+    (*run_labels)[k] = components[labels[k]];
+  if (moments != nullptr) {
+    moments->assign(num_components + 1, RawMoments());
+    for (size_t label = 1; label < label_moments.size(); ++label)
+      (*moments)[components[label]].Add(label_moments[label]);
+  }
+  return num_components;
+}
+
+template size_t LabelRuns<4>(const RunLengthImage &, vector<int32_t> *,
+			     vector<RawMoments> *);
+template size_t LabelRuns<8>(const RunLengthImage &, vector<int32_t> *,
+			     vector<RawMoments> *);
+
+void RawMoments::AddRun(int64_t row, int64_t first_column,
+			int64_t end_column) {
+  Add(RunMoments(row, first_column, end_column));
+}
+
+void RawMoments::Add(const RawMoments &other) {
+  area += other.area;
+  sum_rows += other.sum_rows;
+  sum_columns += other.sum_columns;
+  sum_rows_squared += other.sum_rows_squared;
+  sum_rows_columns += other.sum_rows_columns;
+  sum_columns_squared += other.sum_columns_squared;
+  sum_rows_cubed += other.sum_rows_cubed;
+  sum_rows_squared_columns += other.sum_rows_squared_columns;
+  sum_rows_columns_squared += other.sum_rows_columns_squared;
+  sum_columns_cubed += other.sum_columns_cubed;
+  perimeter += other.perimeter;
+  first_row = min(first_row, other.first_row);
+  last_row = max(last_row, other.last_row);
+  first_column = min(first_column, other.first_column);
+  last_column = max(last_column, other.last_column);
+}
+
+void MomentTable::Reset(size_t size) {
+  for (vector<int64_t> *sums : {&area_, &sum_rows_, &sum_columns_,
+	&sum_rows_squared_, &sum_rows_columns_, &sum_columns_squared_,
+	&perimeter_})
+    sums->assign(size, 0);
+  for (vector<uint64_t> *sums : {&sum_rows_cubed_, &sum_rows_squared_columns_,
+	&sum_rows_columns_squared_, &sum_columns_cubed_})
+    sums->assign(size, 0);
+  // Empty boxes, as in RawMoments.
+  first_row_.assign(size, INT64_MAX);
+  last_row_.assign(size, -1);
+  first_column_.assign(size, INT64_MAX);
+  last_column_.assign(size, -1);
+}
+
+void MomentTable::Grow(int32_t label) {
+  // Geometrically, for labels met in increasing order.
+  const size_t size = max<size_t>(label + 1, 2 * area_.size());
+  for (vector<int64_t> *sums : {&area_, &sum_rows_, &sum_columns_,
+	&sum_rows_squared_, &sum_rows_columns_, &sum_columns_squared_,
+	&perimeter_})
+    sums->resize(size, 0);
+  for (vector<uint64_t> *sums : {&sum_rows_cubed_, &sum_rows_squared_columns_,
+	&sum_rows_columns_squared_, &sum_columns_cubed_})
+    sums->resize(size, 0);
+  first_row_.resize(size, INT64_MAX);
+  last_row_.resize(size, -1);
+  first_column_.resize(size, INT64_MAX);
+  last_column_.resize(size, -1);
+}
+
+void MomentTable::AddRun(int32_t label, int64_t row, int64_t first_column,
+			 int64_t end_column) {
+  AddMoments(label, RunMoments(row, first_column, end_column));
+}
+
+void MomentTable::Add(const MomentTable &other) {
+  if (other.size() > size()) Grow(other.size() - 1);
+  for (size_t label = 0; label < other.size(); ++label)
+    AddMoments(label, other.moments(label));
+}
+
+void MomentTable::AddMoments(int32_t label, const RawMoments &moments) {
+  area_[label] += moments.area;
+  sum_rows_[label] += moments.sum_rows;
+  sum_columns_[label] += moments.sum_columns;
+  sum_rows_squared_[label] += moments.sum_rows_squared;
+  sum_rows_columns_[label] += moments.sum_rows_columns;
+  sum_columns_squared_[label] += moments.sum_columns_squared;
+  sum_rows_cubed_[label] += moments.sum_rows_cubed;
+  sum_rows_squared_columns_[label] += moments.sum_rows_squared_columns;
+  sum_rows_columns_squared_[label] += moments.sum_rows_columns_squared;
+  sum_columns_cubed_[label] += moments.sum_columns_cubed;
+  perimeter_[label] += moments.perimeter;
+  first_row_[label] = min(first_row_[label], moments.first_row);
+  last_row_[label] = max(last_row_[label], moments.last_row);
+  first_column_[label] = min(first_column_[label], moments.first_column);
+  last_column_[label] = max(last_column_[label], moments.last_column);
+}
+
+RawMoments MomentTable::moments(int32_t label) const {
+  RawMoments moments;
+  moments.area = area_[label];
+  moments.sum_rows = sum_rows_[label];
+  moments.sum_columns = sum_columns_[label];
+  moments.sum_rows_squared = sum_rows_squared_[label];
+  moments.sum_rows_columns = sum_rows_columns_[label];
+  moments.sum_columns_squared = sum_columns_squared_[label];
+  moments.sum_rows_cubed = sum_rows_cubed_[label];
+  moments.sum_rows_squared_columns = sum_rows_squared_columns_[label];
+  moments.sum_rows_columns_squared = sum_rows_columns_squared_[label];
+  moments.sum_columns_cubed = sum_columns_cubed_[label];
+  moments.perimeter = perimeter_[label];
+  moments.first_row = first_row_[label];
+  moments.last_row = last_row_[label];
+  moments.first_column = first_column_[label];
+  moments.last_column = last_column_[label];
+  return moments;
+}
+
+template <typename PixelType>
+void ComputeLabelMoments(ImageView<const PixelType> labels, ThreadPool *pool,
+			 MomentTable *table) {
+  if (table == nullptr) abort();
+  const size_t num_rows = labels.num_rows();
+  const size_t num_columns = labels.num_columns();
+  const size_t num_strips = (pool == nullptr) ? 1 :
+    max<size_t>(1, min(pool->num_threads(),
+		       num_rows * num_columns / kMinStripPixels));
+  vector<MomentTable> partial_tables(num_strips);
+  auto sum_strip = [&](size_t s, size_t) {
+    MomentTable &strip_table = partial_tables[s];
+    strip_table.Reset(0);
+    for (size_t i = num_rows * s / num_strips;
+	 i < num_rows * (s + 1) / num_strips; ++i) {
+      const PixelType *pixels = labels.row(i);
+      // The row above may belong to another strip; it is only read.
+      const PixelType *above = (i > 0) ? labels.row(i - 1) : nullptr;
+      for (size_t j = 0; j < num_columns;) {
+	const PixelType label = pixels[j];
+	size_t end = j + 1;
+	while (end < num_columns && pixels[end] == label) ++end;
+	if (label > 0) {
+	  strip_table.Reserve(label);
+	  strip_table.AddRun(label, i, j, end);
+	  if (above != nullptr) {
+	    int64_t shared = 0;
+	    for (size_t k = j; k < end; ++k) shared += (above[k] == label);
+	    strip_table.AddSharedEdges(label, shared);
+	  }
+	}
+	j = end;
+      }
+    }
+    return true;
+  };
+  if (num_strips == 1) sum_strip(0, 0);
+  else pool->ForEach(num_strips, sum_strip);
+
+  table->Reset(0);
+  for (const MomentTable &strip_table : partial_tables)
+    table->Add(strip_table);
+}
+
+template void ComputeLabelMoments(ImageView<const uint8_t>, ThreadPool *,
+				  MomentTable *);
+template void ComputeLabelMoments(ImageView<const int32_t>, ThreadPool *,
+				  MomentTable *);
+
+}  // namespace ComputerVisionProjects
@@ -1,56 +1,63 @@
 // Sophia Xia
-// contains function for applying Binary Threshold to an image
+// contains the program applying Binary Threshold to an image, with ThresholdFile() from threshold.h
 // Reads a given pgm image, and applies binary threshold with the given threshold
+// or with the threshold picked from the histogram of the image with Otsu's method,
+// or with a threshold adapted to the neighborhood of each pixel
 // The modified image is then saved to a new pgm image under the given filename
 
 #include "image.h"
+#include "batch.h"
+#include "threshold.h"
 #include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace std;
 using namespace ComputerVisionProjects;
 
-/**
- * Modifies an image by making it binary based on a threshold
- * @param threshold
- * @param an_image reference to the image which gets modified
- */
-void BinaryThreshold(int threshold, Image *an_image){
-  if (an_image == nullptr) abort();
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
-
-  for(size_t r = 0; r < rows; r++){
-    for(size_t c = 0; c < cols; c++){
-      if (threshold < an_image->GetPixel(r, c))
-        an_image->SetPixel(r,c,255);
-      else
-        an_image->SetPixel(r,c,0);
-    }
-  }
-}
-
 int main(int argc, char **argv){
   
-  if (argc!=4) {
-    printf("Usage: %s gray_level_image gray_level_threshold output_binary_image_filename\n", argv[0]);
+  size_t band_rows = 0;
+  if ((argc!=4 && argc!=5) || (argc==5 && !ParseCount(argv[4], &band_rows))) {
+    printf("Usage: %s gray_level_image gray_level_threshold output_binary_image_filename(.pgm or .pbm) [band_rows]\n", argv[0]);
+    printf("   or: %s input_directory_or_@list threshold output_directory [band_rows]\n", argv[0]);
+    printf("   threshold: a gray level, auto to pick it for each image (Otsu), or auto:K to map each image to K gray levels\n");
+    printf("              or an adaptive threshold for unevenly lit images, bradley[:window[:k]] or sauvola[:window[:k]]\n");
+    printf("   band_rows: a number of rows greater than 0, to stream the image that many rows at a time\n");
     return 0;
   }
   const string input_file(argv[1]);
-  const string threshold(argv[2]);
+  ThresholdMode mode;
+  if (!ParseThreshold(argv[2], &mode)) return 0;
   const string output_file(argv[3]);
-
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  if (mode.num_classes > 2 && IsPbmFilename(output_file)) {
+    cout << "A .pbm output takes 2 classes, not " << mode.num_classes << endl;
     return 0;
   }
 
-  BinaryThreshold(stoi(threshold), &an_image);
-
-  if (!WriteImage(output_file, an_image)){
-    cout << "Can't write to file " << output_file << endl;
+  // batch mode: every image of the input directory (or list) is thresholded into the output directory,
+  // in parallel, each worker reusing its own image buffer
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    if (!inputs.Open(input_file) || !MakeDirectory(output_file)) return 0;
+    ThreadPool pool;
+    vector<Image<uint8_t>> images(pool.num_threads());
+    vector<IntegralImage> integrals(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      return ThresholdFile(image_file, mode, OutputFilename(output_file, Stem(image_file), ".pgm"), band_rows, &images[worker], &integrals[worker], nullptr);
+    });
     return 0;
   }
+
+  // only the histogram of an automatic threshold is worth spreading over threads
+  unique_ptr<ThreadPool> pool;
+  if (mode.num_classes > 0) pool.reset(new ThreadPool);
+  Image<uint8_t> an_image;
+  IntegralImage integral;
+  if (!ThresholdFile(input_file, mode, output_file, band_rows, &an_image, &integral, pool.get())) {
+    cout << "Can't threshold " << input_file << " into " << output_file << endl;
+  }
 }
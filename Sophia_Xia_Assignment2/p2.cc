@@ -1,96 +1,169 @@
 // Sophia Xia
 // contains function that labels all connected components in an image
 // Reads a given pgm image, and labels all the connected components in it
-// The modified image is then saved to a new pgm image under the given filename
+// The modified image is then saved to a new pgm image under the given filename,
+// or, for a .lbl filename, to a 32-bit label image that holds any number of components
 
 #include "image.h"
+#include "batch.h"
+#include "labeling.h"
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
 #include <string>
-#include <map>
+#include <vector>
 
 using namespace std;
 using namespace ComputerVisionProjects;
 
+/**
+ * Calculates the gray level of each component, spread evenly
+ * +1 means white is never an option, important because orientation lines will be drawn in white later
+ * @param num_components the number of components
+ * @param numbers true to keep the component numbers 1, 2, ... as they are, for a .lbl label image
+ * @param an_image reference to the labeled image, whose number of gray levels is set
+ * @return vector<int32_t> the gray level of each component, 0 for the background
+ */
+vector<int32_t> ComponentGrays(size_t num_components, bool numbers, Image<int32_t> *an_image){
+  if (numbers) {
+    vector<int32_t> colors(num_components+1);
+    for(size_t label = 0; label <= num_components; label++){
+      colors[label] = label;
+    }
+    // the largest label goes in the header of the label image
+    an_image->SetNumberGrayLevels(num_components);
+    return colors;
+  }
+  int grays = max<int>(255/(num_components+1), 1);
+  vector<int32_t> colors(num_components+1);
+  for(size_t label = 0; label <= num_components; label++){
+    colors[label] = label*grays;
+  }
+  // past 254 components the labels no longer fit in a byte, and the image is written with 16 bits per pixel
+  an_image->SetNumberGrayLevels(max<int>(255, num_components*grays));
+  return colors;
+}
+
 /**
  * Modifies an image by finding and labeling the connected components
+ * the components are the 8-connected pixels of value 255, every other pixel is background
+ * @param pool the threads that label strips of the image in parallel, or nullptr to label it on this thread
+ * @param numbers true to label the components 1, 2, ... instead of spreading them over the gray levels
  * @param an_image reference to the image which gets modified
  */
-void ConnectedComponents(Image *an_image){
+void ConnectedComponents(ThreadPool *pool, bool numbers, Image<int32_t> *an_image){
   if (an_image == nullptr) abort();
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
-  
-  // equiv: key=label, value=equivalent label
-  map<int, int> equiv;
-
-  int label = 0;
   // First Pass
-  for(size_t r = 0; r < rows; r++){
-    for(size_t c = 0; c < cols; c++){
-      if (an_image->GetPixel(r,c) == 255){
-        int upper = (r-1 >= 0) ? an_image->GetPixel(r-1,c) : 0;
-        int left = (c-1 >= 0) ? an_image->GetPixel(r,c-1) : 0;
-        int upper_left = (r-1 >= 0 && c-1 >= 0) ? an_image->GetPixel(r-1,c-1) : 0;
-        if(upper == 0 && left == 0 && upper_left == 0){
-          label ++;
-          equiv[label] = label;
-          an_image->SetPixel(r,c,equiv[label]);
-        }else if(upper != 0 && left != 0){
-          equiv[left] = equiv[upper];
-          an_image->SetPixel(r,c,equiv[left]);
-        }else if(left != 0){
-          an_image->SetPixel(r,c,equiv[left]);
-        }else if(upper != 0){
-          an_image->SetPixel(r,c,equiv[upper]);
-        }else if(upper_left != 0){
-          an_image->SetPixel(r,c,equiv[upper_left]);
-        }
-      }
+  // each 2x2 block of foreground pixels takes the label of its neighbor blocks above and to the left (8-connectivity)
+  // and the equivalences between the labels are resolved, strips of rows being merged along their boundaries
+  ComponentLabeler<8> labeler;
+  size_t num_components = labeler.Label(an_image, pool);
+  vector<int32_t> colors = ComponentGrays(num_components, numbers, an_image);
+  // Second Pass to resolve equivalences
+  labeler.Relabel(colors, an_image, pool);
+}
+
+/**
+ * Labels the connected components of a packed binary image
+ * the foreground is found a 64 pixel word at a time as runs of pixels, and the runs are labeled,
+ * so the labeling takes time in proportion to the number of runs instead of pixels
+ * @param binary_image the binary image
+ * @param runs reference to the buffer of the runs of the binary image
+ * @param numbers true to label the components 1, 2, ... instead of spreading them over the gray levels
+ * @param an_image reference to the image that receives the labeled components
+ */
+void ConnectedComponents(const BinaryImage &binary_image, RunLengthImage *runs, bool numbers, Image<int32_t> *an_image){
+  if (runs == nullptr || an_image == nullptr) abort();
+  EncodeRuns(binary_image, runs);
+  vector<int32_t> run_labels;
+  size_t num_components = LabelRuns<8>(*runs, &run_labels);
+  an_image->AllocateSpaceAndSetSize(runs->num_rows(), runs->num_columns());
+  vector<int32_t> colors = ComponentGrays(num_components, numbers, an_image);
+  size_t k = 0;
+  for(size_t r = 0; r < runs->num_rows(); r++){
+    int32_t *pixels = an_image->row(r);
+    for(const RunLengthImage::Run *run = runs->row(r); run != runs->row_end(r); ++run, ++k){
+      fill(pixels + run->first_column, pixels + run->end_column, colors[run_labels[k]]);
     }
   }
-  // components: key=label, value=color
-  map<int, int> components;
-  for(auto const& x: equiv){
-    equiv[x.first] = equiv[x.second]; // necessary just in case any equivalencies slipped through and didn't get resolved
-    components[x.second] = 255; // only want values of the equiv map because the equivalencies are resolved there
+}
+
+/**
+ * Labels the connected components of one binary image file
+ * @param input_file the binary image (.pgm or .pbm)
+ * @param output_file the labeled image that gets written (.pgm, or .lbl for a 32-bit label image)
+ * @param preview_file the false-color .ppm preview that gets written, or empty for none
+ * @param an_image reference to the image buffer used, reused from one file to the next
+ * @param binary_image reference to the packed buffer used for .pbm inputs
+ * @param runs reference to the run buffer used for .pbm inputs
+ * @param pool the threads that label the image, or nullptr to label it on this thread
+ * @return bool true if the image was read and written successfully
+ */
+bool LabelFile(const string &input_file, const string &output_file, const string &preview_file, Image<int32_t> *an_image, BinaryImage *binary_image, RunLengthImage *runs, ThreadPool *pool){
+  if (an_image == nullptr || binary_image == nullptr || runs == nullptr) abort();
+  const bool numbers = IsLabelFilename(output_file);
+  if (IsPbmFilename(input_file)) {
+    if (!ReadBinaryImage(input_file, binary_image)) {
+      cout <<"Can't open file " << input_file << endl;
+      return false;
+    }
+    ConnectedComponents(*binary_image, runs, numbers, an_image);
+  } else {
+    if (!ReadImage(input_file, an_image)) {
+      cout <<"Can't open file " << input_file << endl;
+      return false;
+    }
+    ConnectedComponents(pool, numbers, an_image);
   }
-  // Calculating gray level for each component
-  int grays = 255/(components.size()+1); // +1 means white is never an option, important because orientation lines will be drawn in white later
-  for(auto const& x: components){
-    components[x.first] = grays;
-    grays += grays;
+ 
+  if (!(numbers ? WriteLabelImage(output_file, *an_image) : WriteImage(output_file, *an_image))){
+    cout << "Can't write to file " << output_file << endl;
+    return false;
   }
-  // Second Pass to resolve equivalences
-  for(size_t r = 0; r < rows; r++){
-    for(size_t c = 0; c < cols; c++){
-      int pixel = an_image->GetPixel(r,c);
-      if (pixel > 0){
-        an_image->SetPixel(r, c, components[equiv[pixel]]);
-      }
-    }
+  if (!preview_file.empty() && !WriteLabelPreview(preview_file, *an_image)){
+    cout << "Can't write to file " << preview_file << endl;
+    return false;
   }
+  return true;
 }
 
 int main(int argc, char **argv){
   
-  if (argc!=3) {
-    printf("Usage: %s input_image output_image_name\n", argv[0]);
+  if (argc!=3 && argc!=4) {
+    printf("Usage: %s input_image(.pgm or .pbm) output_image_name(.pgm or .lbl) [preview_image_name(.ppm)]\n", argv[0]);
+    printf("   or: %s input_directory_or_@list output_directory [output_extension(.pgm or .lbl)]\n", argv[0]);
+    printf("   a .pgm output past 254 objects is written with 16 bits per pixel, which p3 and p4 read like a .lbl image\n");
     return 0;
   }
   const string input_file(argv[1]);
   const string output_file(argv[2]);
+  // the preview of a single image, or the extension of the images written in batch mode
+  const string option(argc == 4 ? argv[3] : "");
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: every image of the input directory (or list) is labeled into the output directory, in parallel
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    const string extension = option.empty() ? ".pgm" : option;
+    if (extension != ".pgm" && !IsLabelFilename(extension)) {
+      cout << "Output extension must be .pgm or .lbl, not " << extension << endl;
+      return 0;
+    }
+    if (!inputs.Open(input_file) || !MakeDirectory(output_file)) return 0;
+    ThreadPool pool;
+    vector<Image<int32_t>> images(pool.num_threads());
+    vector<BinaryImage> binary_images(pool.num_threads());
+    vector<RunLengthImage> runs(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      return LabelFile(image_file, OutputFilename(output_file, Stem(image_file), extension), "", &images[worker], &binary_images[worker], &runs[worker], nullptr);
+    });
     return 0;
   }
 
-  ConnectedComponents(&an_image);
- 
-  if (!WriteImage(output_file, an_image)){
-    cout << "Can't write to file " << output_file << endl;
-    return 0;
-  }
+  Image<int32_t> an_image;
+  BinaryImage binary_image;
+  RunLengthImage runs;
+  // a single image is labeled in strips, one per thread
+  ThreadPool pool;
+  LabelFile(input_file, output_file, option, &an_image, &binary_image, &runs, &pool);
 }
@@ -1,18 +1,20 @@
 // Sophia Xia
 // contains function that writes attributes of connected components (objects) to a file
-// Reads a given pgm image, and calculates the attributes for connected components in the image
+// Reads a given pgm (or .lbl label) image, and calculates the attributes for connected components in the image
 // Then the attributes of the objects are written to a file
 // a dot is drawn at the center of each object
 // an orientation line originating from the center is also drawn on the image
 // The modified image is then saved to a new pgm image under the given filename
 
 #include "image.h"
+#include "batch.h"
 #include "image_objects.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <set>
 #include <map>
 
@@ -21,12 +23,14 @@ using namespace ComputerVisionProjects;
 
 /**
  * Writes the attributes of all objects in the map to a file
- * each object gets its own line and attributes are separated by spaces
+ * each object gets its own line and attributes are separated by spaces:
+ *  label, center row and column, e_min, area, roundedness, orientation,
+ *  then the bounding box (first row and column, last row and column), the perimeter and the 7 Hu moments
  * @param objects a map where the key is the label of the object
  *  and the value is a struct of all the object attributes
  * @param filename this is the name of the file that will be written to
  */
-void WriteStats(Image *an_image, map<int, struct object_data> objects, string filename){
+void WriteStats(Image<int32_t> *an_image, map<int, struct object_data> objects, string filename){
   ofstream database;
   database.open(filename);
   for(const auto& obj: objects){
@@ -36,33 +40,77 @@ void WriteStats(Image *an_image, map<int, struct object_data> objects, string fi
     database << obj.second.e_min << " ";
     database << obj.second.area << " ";
     database << obj.second.roundedness << " ";
-    database << obj.second.orientation << "\n";
+    database << obj.second.orientation << " ";
+    database << obj.second.min_x << " ";
+    database << obj.second.min_y << " ";
+    database << obj.second.max_x << " ";
+    database << obj.second.max_y << " ";
+    database << obj.second.perimeter;
+    for(double hu: obj.second.hu){
+      database << " " << hu;
+    }
+    database << "\n";
     DrawOrientation(an_image, obj.second);
   }
   database.close();
 }
 
+/**
+ * Computes and writes the attributes of the objects of one labeled image file
+ * @param input_file the labeled image (.pgm, or .lbl made by p2), or a binary image (.pbm, or .pgm when binary is true)
+ * @param binary true if a .pgm input_file is a binary image, labeled here as p2 would in the same pass the attributes are calculated
+ * @param pool the threads that label a binary image, or nullptr to label it on this thread
+ * @param output_file the database that gets written
+ * @param output_image the image with the orientation lines that gets written
+ * @param an_image reference to the image buffer the lines are drawn on, reused from one file to the next
+ * @return bool true if the image was read and written successfully
+ */
+bool DescribeFile(const string &input_file, bool binary, ThreadPool *pool, const string &output_file, const string &output_image, Image<int32_t> *an_image){
+  if (an_image == nullptr) abort();
+  map<int, struct object_data> objects;
+  if (!ReadObjects(input_file, binary, pool, an_image, &objects)) {
+    cout <<"Can't open file " << input_file << endl;
+    return false;
+  }
+  WriteStats(an_image, objects, output_file);
+
+  if (!WriteImage(output_image, *an_image)){
+    cout << "Can't write to file " << output_image << endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char **argv){
 
-  if (argc!=4) {
-    printf("Usage: %s input_labeled_image output_database output_image\n", argv[0]);
+  if ((argc!=4 && argc!=5) || (argc==5 && string(argv[4]) != "binary")) {
+    printf("Usage: %s input_labeled_image output_database output_image [binary]\n", argv[0]);
+    printf("   or: %s input_directory_or_@list output_database_directory output_image_directory [binary]\n", argv[0]);
     return 0;
   }
   const string input_file(argv[1]);
+  // the input is a binary image to label, not a labeled one
+  const bool binary = (argc == 5);
   const string output_file(argv[2]);
   const string output_image(argv[3]);
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: the database (.txt) and image (.pgm) of every labeled image of the input directory (or list)
+  // are written into the output directories, in parallel
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    if (!inputs.Open(input_file) || !MakeDirectory(output_file) || !MakeDirectory(output_image)) return 0;
+    ThreadPool pool;
+    vector<Image<int32_t>> images(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      return DescribeFile(image_file, binary, nullptr, OutputFilename(output_file, stem, ".txt"), OutputFilename(output_image, stem, ".pgm"), &images[worker]);
+    });
     return 0;
   }
 
-  map<int, struct object_data> objects = GetObjectsData(&an_image);	
-  WriteStats(&an_image, objects, output_file);
-
-  if (!WriteImage(output_image, an_image)){
-    cout << "Can't write to file " << output_image << endl;
-    return 0;
-  }
+  Image<int32_t> an_image;
+  // a single binary image is labeled in strips, one per thread
+  ThreadPool pool;
+  DescribeFile(input_file, binary, &pool, output_file, output_image, &an_image);
 }
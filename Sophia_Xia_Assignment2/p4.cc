@@ -1,6 +1,6 @@
 // Sophia Xia
 // contains function that will draw the orientation of the object onto the image if recognized
-// Reads a given pgm image, and calculates the attributes for connected components in the image
+// Reads a given pgm (or .lbl label) image, and calculates the attributes for connected components in the image
 // Then the attributes of the objects are compared to those in a database 
 // if recognized a dot is drawn at the center of the object and
 // an orientation line originating from the center is also drawn on the image
@@ -8,61 +8,327 @@
 
 #include "image.h"
 #include "image_objects.h"
+#include "batch.h"
+#include <cerrno>
 #include <cstdio>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 using namespace ComputerVisionProjects;
 
+// the number of invariants a model is looked up by: its roundedness and its 7 Hu moments
+const int kNumInvariants = 8;
+
+// the degree of each Hu moment in the normalized central moments
+const double kHuDegrees[7] = {1, 2, 2, 2, 4, 3, 4};
+
+// a model of the database, or an object looked up in it
+struct Model{
+  int label;
+  // the roundedness and the Hu moments, which do not change when the object is shifted, scaled or rotated
+  // each Hu moment is taken to the root of its degree, keeping its sign, so all of them are on the scale
+  // of the roundedness and one tolerance fits them all
+  double invariants[kNumInvariants];
+  // the perimeter squared over the area, and the share of its bounding box the object fills
+  // they do not change with scaling but do somewhat with rotation, so they only pick among the models
+  // whose invariants are close enough
+  double compactness;
+  double extent;
+};
+
+/**
+ * Makes the model of an object from its attributes
+ * @param object the attributes, of a model of the database or of an object of the image
+ * @return Model the invariants the object is looked up by and the features that pick among the models found
+ */
+Model MakeModel(const struct object_data &object){
+  Model model;
+  model.label = object.label;
+  model.invariants[0] = object.roundedness;
+  for(int k = 0; k < 7; k++){
+    const double root = pow(abs(object.hu[k]), 1/kHuDegrees[k]);
+    model.invariants[k+1] = (object.hu[k] < 0) ? -root : root;
+  }
+  const double area = object.area;
+  model.compactness = object.perimeter*object.perimeter/area;
+  model.extent = area/((object.max_x - object.min_x + 1)*(object.max_y - object.min_y + 1));
+  return model;
+}
+
+/**
+ * how far an object is from a model whose invariants are all within tolerance of its own
+ * the invariants count the most, and the compactness and extent tell apart models whose invariants are about the same
+ * @param model the model
+ * @param object the object
+ * @param tolerance how close the invariants have to be, which they are measured against
+ * @return double the distance, smaller for a better match
+ */
+double ModelDistance(const Model &model, const Model &object, double tolerance){
+  double distance = 0;
+  for(int k = 0; k < kNumInvariants; k++){
+    const double difference = (object.invariants[k] - model.invariants[k])/tolerance;
+    distance += difference*difference;
+  }
+  const double compactness = log(object.compactness/model.compactness);
+  const double extent = log(object.extent/model.extent);
+  // they change with rotation, so a log ratio of 1 only counts like a tenth of the tolerance
+  return distance + (compactness*compactness + extent*extent)/100;
+}
+
+// the models of a database in a k-d tree over their invariants, kept in an array
+// the model in the middle of a range of the array splits it on one invariant, the next one at each level down,
+// with the models before it not above it on that invariant and the models after it not below it
+// so the models close to an object are found without going over the whole database for every object
+struct ObjectDatabase{
+  vector<Model> models;
+};
+
+/**
+ * Arranges a range of models into a k-d tree
+ * @param first the first model of the range
+ * @param last the model past the range
+ * @param invariant the invariant the range is split on
+ * @param models reference to the models that get rearranged
+ */
+void BuildTree(size_t first, size_t last, int invariant, vector<Model> *models){
+  if (last - first < 2) return;
+  const size_t middle = first + (last - first)/2;
+  nth_element(models->begin() + first, models->begin() + middle, models->begin() + last,
+              [invariant](const Model &a, const Model &b){ return a.invariants[invariant] < b.invariants[invariant]; });
+  const int next = (invariant + 1) % kNumInvariants;
+  BuildTree(first, middle, next, models);
+  BuildTree(middle + 1, last, next, models);
+}
+
+/**
+ * Reads a database written by p3 into a k-d tree, once for all the objects looked up in it
+ * each line has the label, center, e_min, area, roundedness and orientation of a model,
+ * followed by its bounding box, perimeter and Hu moments
+ * @param filename the database file
+ * @param database reference to the tree that gets filled
+ * @return bool true if the file was read
+ */
+bool ReadDatabase(const string &filename, ObjectDatabase *database){
+  if (database == nullptr) abort();
+  ifstream file(filename);
+  if (!file) return false;
+  database->models.clear();
+  string line;
+  while(getline(file, line)){
+    istringstream fields(line);
+    struct object_data object;
+    fields >> object.label >> object.x >> object.y >> object.e_min >> object.area >> object.roundedness >> object.orientation;
+    fields >> object.min_x >> object.min_y >> object.max_x >> object.max_y >> object.perimeter;
+    for(double &hu: object.hu) fields >> hu;
+    // the database ends at the first line without a full model
+    if (!fields) break;
+    database->models.push_back(MakeModel(object));
+  }
+  BuildTree(0, database->models.size(), 0, &database->models);
+  return true;
+}
+
 /**
- * calculates the attributes for connected components in the image
- * Then the attributes of the objects are compared to those in a database 
- * - currently only roundedness is being used as a comparison metric
- *   - it is not sensitive to shifting, scaling, or rotation unlike the others making it ideal
+ * Looks for the model an object matches best in a range of the k-d tree
+ * only the halves of the range whose side of the split can be within tolerance of the object are searched
+ * @param database the tree of the models
+ * @param first the first model of the range
+ * @param last the model past the range
+ * @param invariant the invariant the range is split on
+ * @param object the model of the object
+ * @param tolerance how close every invariant has to be
+ * @param found reference to the label of the best model so far, -1 if none
+ * @param best reference to the distance of the best model so far
+ */
+void SearchTree(const ObjectDatabase &database, size_t first, size_t last, int invariant, const Model &object, double tolerance, int *found, double *best){
+  if (first >= last) return;
+  const size_t middle = first + (last - first)/2;
+  const Model &model = database.models[middle];
+  bool close = true;
+  for(int k = 0; k < kNumInvariants && close; k++){
+    close = abs(object.invariants[k] - model.invariants[k]) <= tolerance;
+  }
+  if (close){
+    const double distance = ModelDistance(model, object, tolerance);
+    // equally close models go to the lowest label, whatever order the tree visits them in
+    if (*found == -1 || distance < *best || (distance == *best && model.label < *found)){
+      *found = model.label;
+      *best = distance;
+    }
+  }
+  const int next = (invariant + 1) % kNumInvariants;
+  if (object.invariants[invariant] - tolerance <= model.invariants[invariant]){
+    SearchTree(database, first, middle, next, object, tolerance, found, best);
+  }
+  if (object.invariants[invariant] + tolerance >= model.invariants[invariant]){
+    SearchTree(database, middle + 1, last, next, object, tolerance, found, best);
+  }
+}
+
+/**
+ * Finds the model of the database that an object matches best
+ * the models whose invariants are all within tolerance of those of the object are candidates,
+ * and the closest one is picked
+ * @param database the tree of the models
+ * @param object the model of the object
+ * @param tolerance how close every invariant has to be
+ * @return int the label of the model, or -1 if no model is close enough
+ */
+int FindModel(const ObjectDatabase &database, const Model &object, double tolerance){
+  int found = -1;
+  double best = 0;
+  SearchTree(database, 0, database.models.size(), 0, object, tolerance, &found, &best);
+  return found;
+}
+
+/**
+ * Reads the tolerance of the recognition from the command line
+ * @param argument the command line argument
+ * @param tolerance reference to the tolerance, set if argument is a number greater than 0
+ * @return bool true if argument is a number greater than 0
+ */
+bool ParseTolerance(const string &argument, double *tolerance){
+  if (tolerance == nullptr) abort();
+  char *end;
+  errno = 0;
+  const double value = strtod(argument.c_str(), &end);
+  if (argument.empty() || *end != '\0' || errno != 0 || !(value > 0)) return false;
+  *tolerance = value;
+  return true;
+}
+
+/**
+ * the attributes of the connected components in the image are compared to those in a database 
+ * - each object is looked up in the k-d tree of the database by its invariants, and the closest model found
+ *   is picked also by the compactness and extent
  * if recognized a dot is drawn at the center of the object and
  * an orientation line originating from the center is also drawn on the image
- * @param an_image reference to the image which gets modified
- * @param filename this is the name of the file that the image will be written to
+ * @param objects the attributes of the connected components of the image
+ * @param database the index of the known objects
+ * @param tolerance how close every invariant of an object has to be to that of a model
+ * @param an_image reference to the copy of the image which gets modified
+ * @param verbose true to list every object on log, with the model it was recognized as
+ * @param log the stream the objects are listed on
  */
-void ObjectRecognition(Image *an_image, string filename){
-	ifstream database;
-	database.open(filename);
-	int label, cx, cy, area;
-	double e_min, roundedness, orientation;
-  map<int, struct object_data> objects = GetObjectsData(an_image);	
-	while(database >> label >> cx >> cy >> e_min >> area >> roundedness >> orientation){
-    for(const auto& obj: objects){
-      cout << obj.first << endl;
-      if (abs(obj.second.roundedness - roundedness) <= 0.02){ // .02 worked for me through trial and error
-        DrawOrientation(an_image, obj.second);
-      }
+void ObjectRecognition(const map<int, struct object_data> &objects, const ObjectDatabase &database, double tolerance, Image<int32_t> *an_image, bool verbose, ostream &log){
+  for(const auto& obj: objects){
+    int model = FindModel(database, MakeModel(obj.second), tolerance);
+    if (verbose){
+      log << obj.first;
+      if (model >= 0) log << " recognized as " << model;
+      log << endl;
+    }
+    if (model >= 0){
+      DrawOrientation(an_image, obj.second);
     }
-	}
+  }
+}
+
+/**
+ * Recognizes the objects of one labeled image file and writes the image with their orientation lines
+ * @param input_file the labeled image (.pgm, or .lbl made by p2), or a binary image (.pbm, or .pgm when binary is true)
+ * @param binary true if a .pgm input_file is a binary image, labeled here as p2 would in the same pass the attributes are calculated
+ * @param pool the threads that label a binary image, or nullptr to label it on this thread
+ * @param database the index of the known objects
+ * @param tolerance see ObjectRecognition()
+ * @param output_file the image that gets written
+ * @param an_image reference to the image buffer the lines are drawn on, reused from one file to the next
+ * @param verbose true to list every object on log
+ * @param log the stream the objects are listed on
+ * @return bool true if the image was read and written successfully
+ */
+bool RecognizeFile(const string &input_file, bool binary, ThreadPool *pool, const ObjectDatabase &database, double tolerance, const string &output_file, Image<int32_t> *an_image, bool verbose, ostream &log){
+  if (an_image == nullptr) abort();
+  map<int, struct object_data> objects;
+  if (!ReadObjects(input_file, binary, pool, an_image, &objects)) {
+    cout <<"Can't open file " << input_file << endl;
+    return false;
+  }
+
+  ObjectRecognition(objects, database, tolerance, an_image, verbose, log);
+  
+  if (!WriteImage(output_file, *an_image)){
+    cout << "Can't write to file " << output_file << endl;
+    return false;
+  }
+  return true;
 }
 
 int main(int argc, char **argv){
   
-  if (argc!=4) {
-    printf("Usage: %s input_file db_file output_file\n", argv[0]);
+  // the input is a binary image to label, not a labeled one
+  bool binary = false;
+  // every object is listed with the model it was recognized as
+  bool verbose = false;
+  // how close every invariant of an object has to be to that of a model, .02 worked for me through trial and error
+  double tolerance = 0.02;
+  bool options = (argc >= 4);
+  for(int i = 4; i < argc; i++){
+    if (string(argv[i]) == "binary") binary = true;
+    else if (string(argv[i]) == "verbose") verbose = true;
+    else if (!ParseTolerance(argv[i], &tolerance)) options = false;
+  }
+  if (!options) {
+    printf("Usage: %s input_file db_file output_file [binary] [verbose] [tolerance]\n", argv[0]);
+    printf("   or: %s input_directory_or_@list db_file_or_directory output_directory [binary] [verbose] [tolerance]\n", argv[0]);
+    printf("   tolerance: a number greater than 0, how close every invariant of an object has to be to a model (.02 by default)\n");
     return 0;
   }
   const string input_file(argv[1]);
   const string database_file(argv[2]);
   const string output_file(argv[3]);
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: every labeled image of the input directory (or list) is recognized, in parallel,
+  // against the single database or against the database with the same name in the database directory
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    BatchInput databases;
+    if (!inputs.Open(input_file) || !databases.Open(database_file) || !MakeDirectory(output_file)) return 0;
+    // a single database is read once for all the images
+    ObjectDatabase shared_database;
+    if (!databases.is_batch() && !ReadDatabase(database_file, &shared_database)) {
+      cout <<"Can't open file " << database_file << endl;
+      return 0;
+    }
+    ThreadPool pool;
+    vector<Image<int32_t>> images(pool.num_threads());
+    // each image lists its objects on its own log, printed in order once all are done
+    vector<string> logs(inputs.files().size());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      ObjectDatabase frame_database;
+      if (databases.is_batch()) {
+        string frame_database_file;
+        if (!databases.Find(stem, &frame_database_file)) return false;
+        if (!ReadDatabase(frame_database_file, &frame_database)) {
+          cout <<"Can't open file " << frame_database_file << endl;
+          return false;
+        }
+      }
+      ostringstream log;
+      bool recognized = RecognizeFile(image_file, binary, nullptr, databases.is_batch() ? frame_database : shared_database, tolerance, OutputFilename(output_file, stem, ".pgm"), &images[worker], verbose, log);
+      logs[i] = log.str();
+      return recognized;
+    });
+    for (const string &log: logs) cout << log;
     return 0;
   }
 
-  ObjectRecognition(&an_image, database_file); 
-  
-  if (!WriteImage(output_file, an_image)){
-    cout << "Can't write to file " << output_file << endl;
+  ObjectDatabase database;
+  if (!ReadDatabase(database_file, &database)) {
+    cout <<"Can't open file " << database_file << endl;
     return 0;
   }
+  Image<int32_t> an_image;
+  // a single binary image is labeled in strips, one per thread
+  ThreadPool pool;
+  RecognizeFile(input_file, binary, &pool, database, tolerance, output_file, &an_image, verbose, cout);
 }
@@ -0,0 +1,334 @@
+// Automatic selection of gray level thresholds from the histogram of an
+// image, with Otsu's criterion, and locally adaptive thresholds.
+
+#include "threshold.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+namespace ComputerVisionProjects {
+
+namespace {
+
+// Rows counted by one task of ComputeHistogram(), enough to be worth
+// handing to a worker.
+const size_t kMinStripPixels = 1 << 16;
+
+// Adds the pixels of rows [first_row, last_row) of an_image to histogram.
+// Consecutive pixels go to four separate tables, so that a run of equal
+// pixels does not wait on the previous increment of the same counter.
+void CountRows(ImageView<const uint8_t> an_image, size_t first_row,
+	       size_t last_row, vector<size_t> *histogram) {
+  vector<size_t> tables(4 * kHistogramBins, 0);
+  size_t *table_0 = &tables[0];
+  size_t *table_1 = table_0 + kHistogramBins;
+  size_t *table_2 = table_1 + kHistogramBins;
+  size_t *table_3 = table_2 + kHistogramBins;
+  const size_t num_columns = an_image.num_columns();
+  for (size_t i = first_row; i < last_row; ++i) {
+    const uint8_t *pixels = an_image.row(i);
+    size_t j = 0;
+    for (; j + 4 <= num_columns; j += 4) {
+      ++table_0[pixels[j]];
+      ++table_1[pixels[j + 1]];
+      ++table_2[pixels[j + 2]];
+      ++table_3[pixels[j + 3]];
+    }
+    for (; j < num_columns; ++j) ++table_0[pixels[j]];
+  }
+  for (size_t level = 0; level < kHistogramBins; ++level)
+    (*histogram)[level] += table_0[level] + table_1[level] + table_2[level] +
+      table_3[level];
+}
+
+}  // namespace
+
+void ComputeHistogram(ImageView<const uint8_t> an_image, ThreadPool *pool,
+		      vector<size_t> *histogram) {
+  if (histogram == nullptr) abort();
+  histogram->assign(kHistogramBins, 0);
+  const size_t num_rows = an_image.num_rows();
+  const size_t num_columns = max<size_t>(an_image.num_columns(), 1);
+  const size_t num_strips = (pool == nullptr) ? 1 :
+    min(pool->num_threads(),
+	num_rows * num_columns / kMinStripPixels + 1);
+  if (num_strips <= 1) {
+    CountRows(an_image, 0, num_rows, histogram);
+    return;
+  }
+  vector<vector<size_t>> strips(num_strips,
+				vector<size_t>(kHistogramBins, 0));
+  pool->ForEach(num_strips, [&](size_t s, size_t) {
+    CountRows(an_image, num_rows * s / num_strips,
+	      num_rows * (s + 1) / num_strips, &strips[s]);
+    return true;
+  });
+  for (const vector<size_t> &strip : strips)
+    for (size_t level = 0; level < kHistogramBins; ++level)
+      (*histogram)[level] += strip[level];
+}
+
+bool StreamHistogram(const string &input_filename, size_t band_rows,
+		     vector<size_t> *histogram) {
+  if (histogram == nullptr) abort();
+  PgmBandReader reader;
+  if (!reader.Open(input_filename)) return false;
+  if (reader.num_gray_levels() >= kHistogramBins) {
+    cout << "StreamHistogram: Expected 8-bit .pgm file" << endl;
+    return false;
+  }
+  histogram->assign(kHistogramBins, 0);
+  Image<uint8_t> band;
+  while (reader.ReadBand(band_rows, 0, &band))
+    CountRows(band.view(), 0, reader.band_rows(), histogram);
+  return true;
+}
+
+vector<int> MultiOtsuThresholds(const vector<size_t> &histogram,
+				size_t num_thresholds) {
+  const size_t num_levels = histogram.size();
+  const size_t num_classes = num_thresholds + 1;
+  if (num_thresholds == 0 || num_classes > num_levels) abort();
+  // Prefix sums of the pixel counts and of the gray levels, so that the
+  // sums over any class take O(1).
+  vector<double> count_sum(num_levels + 1, 0.0);
+  vector<double> level_sum(num_levels + 1, 0.0);
+  for (size_t level = 0; level < num_levels; ++level) {
+    count_sum[level + 1] = count_sum[level] + histogram[level];
+    level_sum[level + 1] = level_sum[level] +
+      static_cast<double>(level) * histogram[level];
+  }
+  // The between-class variance is, up to terms that do not depend on
+  // the thresholds, the sum over the classes of (sum of levels)^2 / count.
+  auto class_term = [&](size_t first, size_t last) {
+    const double count = count_sum[last + 1] - count_sum[first];
+    const double sum = level_sum[last + 1] - level_sum[first];
+    return (count > 0) ? sum * sum / count : 0.0;
+  };
+  // best[k][level] is the largest sum for k + 1 classes covering the
+  // levels up to level, with the last class ending there; last_start
+  // records where that last class starts.
+  vector<vector<double>> best(num_classes, vector<double>(num_levels, 0.0));
+  vector<vector<size_t>> last_start(num_classes,
+				    vector<size_t>(num_levels, 0));
+  for (size_t level = 0; level < num_levels; ++level)
+    best[0][level] = class_term(0, level);
+  for (size_t k = 1; k < num_classes; ++k) {
+    for (size_t level = k; level < num_levels; ++level) {
+      best[k][level] = -1.0;
+      for (size_t start = k; start <= level; ++start) {
+	const double value = best[k - 1][start - 1] + class_term(start, level);
+	if (value > best[k][level]) {
+	  best[k][level] = value;
+	  last_start[k][level] = start;
+	}
+      }
+    }
+  }
+  // Every class ends one level before the next one starts.
+  vector<int> thresholds(num_thresholds);
+  size_t level = num_levels - 1;
+  for (size_t k = num_thresholds; k > 0; --k) {
+    level = last_start[k][level] - 1;
+    thresholds[k - 1] = level;
+  }
+  return thresholds;
+}
+
+void MultiThreshold(const vector<int> &thresholds,
+		    ImageView<uint8_t> an_image) {
+  const size_t num_rows = an_image.num_rows();
+  const size_t num_columns = an_image.num_columns();
+  if (thresholds.size() == 1) {
+    for (size_t i = 0; i < num_rows; ++i)
+      ThresholdPixels(an_image.row(i), num_columns, thresholds[0]);
+    return;
+  }
+  // The class of each gray level, looked up for every pixel.
+  const size_t num_classes = thresholds.size() + 1;
+  uint8_t class_levels[kHistogramBins];
+  size_t pixel_class = 0;
+  for (size_t level = 0; level < kHistogramBins; ++level) {
+    while (pixel_class < thresholds.size() &&
+	   static_cast<int>(level) > thresholds[pixel_class])
+      ++pixel_class;
+    class_levels[level] = 255 * pixel_class / (num_classes - 1);
+  }
+  for (size_t i = 0; i < num_rows; ++i) {
+    uint8_t *pixels = an_image.row(i);
+    for (size_t j = 0; j < num_columns; ++j)
+      pixels[j] = class_levels[pixels[j]];
+  }
+}
+
+void AdaptiveThreshold(AdaptiveMethod method, size_t window, double k,
+		       ImageView<uint8_t> an_image, IntegralImage *integral) {
+  if (integral == nullptr || method == AdaptiveMethod::kNone) abort();
+  const bool sauvola = (method == AdaptiveMethod::kSauvola);
+  integral->Compute(ImageView<const uint8_t>(an_image), sauvola);
+  const size_t num_rows = an_image.num_rows();
+  const size_t num_columns = an_image.num_columns();
+  const size_t before = window / 2;
+  const size_t after = window - before;
+  for (size_t i = 0; i < num_rows; ++i) {
+    const size_t first_row = (i > before) ? i - before : 0;
+    const size_t end_row = min(i + after, num_rows);
+    uint8_t *pixels = an_image.row(i);
+    for (size_t j = 0; j < num_columns; ++j) {
+      const size_t first_column = (j > before) ? j - before : 0;
+      const size_t end_column = min(j + after, num_columns);
+      const double count = static_cast<double>(end_row - first_row) *
+	(end_column - first_column);
+      const double mean =
+	integral->Sum(first_row, first_column, end_row, end_column) / count;
+      double threshold = mean * (1 - k);
+      if (sauvola) {
+	const double variance = integral->SquareSum(first_row, first_column,
+						    end_row, end_column) /
+	  count - mean * mean;
+	threshold = mean * (1 + k * (sqrt(max(variance, 0.0)) / 128 - 1));
+      }
+      pixels[j] = (pixels[j] > threshold) ? 255 : 0;
+    }
+  }
+}
+
+bool ParseThreshold(const string &argument, ThresholdMode *mode) {
+  if (mode == nullptr) abort();
+  *mode = ThresholdMode();
+  char *end = nullptr;
+  if (argument == "auto") {
+    mode->num_classes = 2;
+    return true;
+  }
+  if (argument.compare(0, 5, "auto:") == 0) {
+    const long classes = strtol(argument.c_str() + 5, &end, 10);
+    if (*end != '\0' || classes < 2 ||
+	classes > static_cast<long>(kHistogramBins)) {
+      cout << "ParseThreshold: auto:K needs 2 <= K <= 256" << endl;
+      return false;
+    }
+    mode->num_classes = classes;
+    return true;
+  }
+  const string method = argument.substr(0, argument.find(':'));
+  if (method == "bradley" || method == "sauvola") {
+    mode->method = (method == "bradley") ? AdaptiveMethod::kBradley :
+      AdaptiveMethod::kSauvola;
+    mode->window = 15;
+    mode->k = (method == "bradley") ? 0.15 : 0.2;
+    const char *parameters = argument.c_str() + method.size();
+    if (*parameters == ':') {
+      const long window = strtol(parameters + 1, &end, 10);
+      if (end == parameters + 1 || window < 1) {
+	cout << "ParseThreshold: Invalid window in " << argument << endl;
+	return false;
+      }
+      mode->window = window;
+      parameters = end;
+    }
+    if (*parameters == ':') {
+      mode->k = strtod(parameters + 1, &end);
+      if (end == parameters + 1) {
+	cout << "ParseThreshold: Invalid k in " << argument << endl;
+	return false;
+      }
+      parameters = end;
+    }
+    if (*parameters != '\0') {
+      cout << "ParseThreshold: Invalid threshold " << argument << endl;
+      return false;
+    }
+    return true;
+  }
+  const long level = strtol(argument.c_str(), &end, 10);
+  if (argument.empty() || *end != '\0') {
+    cout << "ParseThreshold: Invalid threshold " << argument << endl;
+    return false;
+  }
+  mode->threshold = level;
+  return true;
+}
+
+void ApplyThresholds(const ThresholdMode &mode, const vector<int> &thresholds,
+		     ImageView<uint8_t> an_image, IntegralImage *integral) {
+  if (mode.method != AdaptiveMethod::kNone)
+    AdaptiveThreshold(mode.method, mode.window, mode.k, an_image, integral);
+  else
+    MultiThreshold(thresholds, an_image);
+}
+
+bool StreamThreshold(const string &input_filename, const ThresholdMode &mode,
+		     const vector<int> &thresholds,
+		     const string &output_filename, size_t band_rows,
+		     IntegralImage *integral) {
+  PgmBandReader reader;
+  if (!reader.Open(input_filename)) return false;
+  // The thresholds are gray levels of 8-bit images; a 16-bit image is
+  // rejected rather than converted.
+  if (reader.num_gray_levels() >= kHistogramBins) {
+    cout << "StreamThreshold: Expected 8-bit .pgm file" << endl;
+    return false;
+  }
+  PgmBandWriter writer;
+  if (!writer.Open(output_filename, reader.num_rows(), reader.num_columns(),
+		   reader.num_gray_levels()))
+    return false;
+  const size_t halo =
+    (mode.method != AdaptiveMethod::kNone) ? mode.window / 2 : 0;
+  Image<uint8_t> band;
+  while (reader.ReadBand(band_rows, halo, &band)) {
+    ApplyThresholds(mode, thresholds, band.view(), integral);
+    if (!writer.WriteRows(band, reader.halo_above(), reader.band_rows()))
+      return false;
+  }
+  return writer.Close();
+}
+
+bool ThresholdFile(const string &input_filename, const ThresholdMode &mode,
+		   const string &output_filename, size_t band_rows,
+		   Image<uint8_t> *an_image, IntegralImage *integral,
+		   ThreadPool *pool) {
+  if (an_image == nullptr || integral == nullptr) abort();
+  vector<int> thresholds = {mode.threshold};
+  vector<size_t> histogram;
+  // Streaming writes pgm files only; a pbm output is always made from
+  // the whole image.
+  if (band_rows > 0 && !IsPbmFilename(output_filename)) {
+    // The histogram takes a first pass over the file.
+    if (mode.num_classes > 0) {
+      if (!StreamHistogram(input_filename, band_rows, &histogram))
+	return false;
+      thresholds = MultiOtsuThresholds(histogram, mode.num_classes - 1);
+    }
+    return StreamThreshold(input_filename, mode, thresholds, output_filename,
+			   band_rows, integral);
+  }
+
+  if (!ReadImage(input_filename, an_image)) return false;
+  if (mode.num_classes > 0) {
+    ComputeHistogram(an_image->view(), pool, &histogram);
+    thresholds = MultiOtsuThresholds(histogram, mode.num_classes - 1);
+  }
+
+  // A pbm output is packed to one bit per pixel without going through a
+  // gray level image, except after an adaptive threshold, which leaves
+  // the 255 pixels above 0.
+  if (IsPbmFilename(output_filename)) {
+    if (mode.method != AdaptiveMethod::kNone) {
+      ApplyThresholds(mode, thresholds, an_image->view(), integral);
+      thresholds = {0};
+    }
+    BinaryImage binary_image;
+    ThresholdToBinary(*an_image, thresholds[0], &binary_image);
+    return WriteBinaryImage(output_filename, binary_image);
+  }
+  ApplyThresholds(mode, thresholds, an_image->view(), integral);
+  return WriteImage(output_filename, *an_image);
+}
+
+}  // namespace ComputerVisionProjects
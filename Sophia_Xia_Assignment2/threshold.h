@@ -0,0 +1,129 @@
+// Automatic selection of gray level thresholds from the histogram of an
+// image, with Otsu's criterion (N. Otsu, "A threshold selection method
+// from gray-level histograms", IEEE Trans. SMC 9(1), 1979), and locally
+// adaptive thresholds for unevenly lit images.
+// Sample usage:
+//   vector<size_t> histogram;
+//   ComputeHistogram(an_image.view(), nullptr, &histogram);
+//   MultiThreshold(MultiOtsuThresholds(histogram, 1), an_image.view());
+
+#ifndef COMPUTER_VISION_THRESHOLD_H_
+#define COMPUTER_VISION_THRESHOLD_H_
+
+#include "batch.h"
+#include "image.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ComputerVisionProjects {
+
+// Number of bins of the histogram of an 8-bit image.
+const size_t kHistogramBins = 256;
+
+// Sets histogram to the number of pixels of an_image at each gray level.
+// With a pool, strips of rows are counted in parallel and then added
+// up; pool may be nullptr, e.g. when its workers are already busy with
+// other images.
+void ComputeHistogram(ImageView<const uint8_t> an_image, ThreadPool *pool,
+		      std::vector<size_t> *histogram);
+
+// Same for the 8-bit pgm file input_filename, read band_rows rows at a
+// time so that the whole image never has to be in memory.
+// Returns true if  everyhing is OK, false otherwise.
+bool StreamHistogram(const std::string &input_filename, size_t band_rows,
+		     std::vector<size_t> *histogram);
+
+// Returns the num_thresholds increasing thresholds that split the gray
+// levels of histogram into num_thresholds + 1 classes (levels up to the
+// first threshold, levels above it up to the second, ...) with the
+// largest between-class variance. A single threshold is Otsu's.
+std::vector<int> MultiOtsuThresholds(const std::vector<size_t> &histogram,
+				     size_t num_thresholds);
+
+// Maps every pixel of an_image to its class for thresholds (see
+// MultiOtsuThresholds()), spread evenly over 0..255: one threshold makes
+// the image binary, two make it 0, 127 and 255, and so on.
+void MultiThreshold(const std::vector<int> &thresholds,
+		    ImageView<uint8_t> an_image);
+
+// Locally adaptive threshold methods, comparing each pixel with the mean
+// m (and standard deviation s) of the window around it:
+//  - Bradley: above m * (1 - k) (D. Bradley, G. Roth, "Adaptive
+//    thresholding using the integral image", J. Graphics Tools, 2007);
+//  - Sauvola: above m * (1 + k * (s / 128 - 1)) (J. Sauvola,
+//    M. Pietikainen, "Adaptive document image binarization", Pattern
+//    Recognition 33, 2000).
+enum class AdaptiveMethod { kNone, kBradley, kSauvola };
+
+// Sets every pixel of an_image to 255 if it is above the threshold of
+// method for the window by window pixels centered on it (cut at the
+// borders of an_image), to 0 otherwise. The window sums come from
+// integral, recomputed for an_image, so every pixel takes O(1) whatever
+// the window size.
+void AdaptiveThreshold(AdaptiveMethod method, size_t window, double k,
+		       ImageView<uint8_t> an_image, IntegralImage *integral);
+
+// How to threshold an image, as given on the command line.
+struct ThresholdMode {
+  ThresholdMode(): threshold{0}, num_classes{0},
+		   method{AdaptiveMethod::kNone}, window{0}, k{0} { }
+
+  // A global threshold.
+  int threshold;
+  // Automatic (Otsu) thresholds: the number of classes, 0 if not.
+  size_t num_classes;
+  // Adaptive thresholds: the method (kNone if not) and its parameters.
+  AdaptiveMethod method;
+  size_t window;
+  double k;
+};
+
+// Parses a threshold argument:
+//  - a gray level;
+//  - "auto" for the Otsu threshold of each image, or "auto:K" for K
+//    classes (K - 1 thresholds);
+//  - "bradley[:window[:k]]" or "sauvola[:window[:k]]" for an adaptive
+//    threshold (window 15 by default, k 0.15 for Bradley and 0.2 for
+//    Sauvola).
+// Returns false if argument is none of them.
+bool ParseThreshold(const std::string &argument, ThresholdMode *mode);
+
+// Thresholds an_image as mode says: with its adaptive method if it has
+// one, otherwise with thresholds (see MultiThreshold()). integral is
+// only used by the adaptive methods, and reused from one call to the
+// next.
+void ApplyThresholds(const ThresholdMode &mode,
+		     const std::vector<int> &thresholds,
+		     ImageView<uint8_t> an_image, IntegralImage *integral);
+
+// Same for the 8-bit pgm file input_filename, written to the pgm file
+// output_filename band_rows rows at a time so that the whole image never
+// has to be in memory. Each band is read with the rows the window of an
+// adaptive method needs around it, so the output is the same as for the
+// whole image.
+// Returns true if  everyhing is OK, false otherwise.
+bool StreamThreshold(const std::string &input_filename,
+		     const ThresholdMode &mode,
+		     const std::vector<int> &thresholds,
+		     const std::string &output_filename, size_t band_rows,
+		     IntegralImage *integral);
+
+// Thresholds the 8-bit pgm file input_filename as mode says, with the
+// Otsu thresholds of its own histogram for automatic thresholds, and
+// writes the result to output_filename: a pgm file, or a pbm file for 2
+// classes. If band_rows is not 0, a pgm output is streamed that many rows
+// at a time (see StreamThreshold()). an_image and integral are buffers
+// reused from one file to the next. The histogram is counted on pool,
+// which may be nullptr.
+// Returns true if  everyhing is OK, false otherwise.
+bool ThresholdFile(const std::string &input_filename,
+		   const ThresholdMode &mode,
+		   const std::string &output_filename, size_t band_rows,
+		   Image<uint8_t> *an_image, IntegralImage *integral,
+		   ThreadPool *pool);
+
+}  // namespace ComputerVisionProjects
+
+#endif  // COMPUTER_VISION_THRESHOLD_H_
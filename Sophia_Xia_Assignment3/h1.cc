@@ -3,6 +3,7 @@
 // Reads a given pgm image, and applies the sobel mask for edge detection
 // The modified image is then saved to a new pgm image under the given filename
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -13,95 +14,137 @@ using namespace std;
 using namespace ComputerVisionProjects;
 
 /**
- * calculates whether or not the given coordinates are within the bounds of an image
- * @param an_image reference to the image
- * @param row x coordinate of the coordinate pair
- * @param col y coordinate of the coordinate pair
- * @return bool True if coordinate pair is within image bounds, else False 
+ * copies an image into the center of a larger image surrounded by a border of zeros
+ * so that a mask can be applied at every pixel without checking bounds
+ * @param an_image view of the image, or of the region of it, to copy
+ * @param border width of the zero border in pixels
+ * @param padded reference to the image that receives the padded copy
  */
-bool inBounds(const Image *an_image, int row, int col){
-  int rows = an_image->num_rows();
-  int cols = an_image->num_columns();
-  return(row >= 0 && col >= 0 && row < rows && col < cols);
+void PadWithZeros(ImageView<const uint16_t> an_image, int border, Image<int32_t> *padded){
+  if (padded == nullptr) abort();
+  int rows = an_image.num_rows();
+  int cols = an_image.num_columns();
+  padded->AllocateSpaceAndSetSize(rows + 2*border, cols + 2*border);
+  for(int r = 0; r < rows; r++){
+    const uint16_t *source = an_image.row(r);
+    int32_t *destination = padded->row(r + border) + border;
+    for(int c = 0; c < cols; c++){
+      destination[c] = source[c];
+    }
+  }
 }
 
 /**
- * calculates the 3x3 sobel x or y derivative of a given point in an image 
- * @param an_image reference to the image
- * @param x_deriv if True, function calculates the x deriv, if false function calculated the y deriv
- * @param row x coordinate of the coordinate pair
- * @param col y coordinate of the coordinate pair
- * @return int the x_derivative or y_derivative dependent on param x_deriv
+ * modifies image, or a region of it, by applying sobel 3x3 edge detection mask 
+ * pixels outside the image (or region) are treated as 0
+ * @param an_image view of the pixels which get modified
  */
-int sobel_deriv(const Image *an_image, bool x_deriv, int row, int col){
-  std::vector<int> sobel3_gradient = {1,2,1,0,0,0,-1,-2,-1};
-  if(x_deriv) sobel3_gradient = {-1,0,1,-2,0,2,-1,0,1};
-  int deriv = 0;
-  if(inBounds(an_image, row, col)) deriv += an_image->GetPixel(row,col)*sobel3_gradient[8];
-  if(inBounds(an_image, row, col -1)) deriv += an_image->GetPixel(row,col-1)*sobel3_gradient[7];
-  if(inBounds(an_image, row, col -2)) deriv += an_image->GetPixel(row,col-2)*sobel3_gradient[6];
-  if(inBounds(an_image, row-1, col)) deriv += an_image->GetPixel(row-1,col)*sobel3_gradient[5];
-  if(inBounds(an_image, row-1, col -1)) deriv += an_image->GetPixel(row-1,col-1)*sobel3_gradient[4];
-  if(inBounds(an_image, row-1, col -2)) deriv += an_image->GetPixel(row-1,col-2)*sobel3_gradient[3];
-  if(inBounds(an_image, row-2, col)) deriv += an_image->GetPixel(row-2,col)*sobel3_gradient[2];
-  if(inBounds(an_image, row-2, col -1)) deriv += an_image->GetPixel(row-2,col-1)*sobel3_gradient[1];
-  if(inBounds(an_image, row-2, col -2)) deriv += an_image->GetPixel(row-2,col-2)*sobel3_gradient[0];
-  return deriv;
+void EdgeDetection(ImageView<uint16_t> an_image){
+  int rows = an_image.num_rows();
+  int cols = an_image.num_columns();
+
+  // padded keeps the original pixels, so the result can be written in place
+  Image<int32_t> padded;
+  PadWithZeros(an_image, 1, &padded);
+
+  for(int r = 0; r < rows; r++){
+    // the three padded rows centered on row r, shifted so that index c is column c-1
+    const int32_t *above = padded.row(r);
+    const int32_t *center = padded.row(r+1);
+    const int32_t *below = padded.row(r+2);
+    uint16_t *gradients = an_image.row(r);
+    for(int c = 0; c < cols; c++){
+      // sobel masks {-1,0,1,-2,0,2,-1,0,1} (x) and {1,2,1,0,0,0,-1,-2,-1} (y)
+      int x_deriv = (above[c+2] - above[c]) + 2*(center[c+2] - center[c]) + (below[c+2] - below[c]);
+      int y_deriv = (above[c] + 2*above[c+1] + above[c+2]) - (below[c] + 2*below[c+1] + below[c+2]);
+      gradients[c] = sqrt(static_cast<double>(x_deriv*x_deriv + y_deriv*y_deriv));
+    }
+  }
 }
 
+/**
+ * Applies the sobel mask to an image a band of rows at a time, so that the
+ * whole image never has to be in memory. Every band is read with one row of
+ * halo above and below, so its rows get the same result as in the whole image
+ * @param input_file the gray level image
+ * @param output_file the edge image that gets written
+ * @param band_rows the number of rows per band
+ * @return bool true if the image was read and written successfully
+ */
+bool StreamEdgeDetection(const string &input_file, const string &output_file, size_t band_rows){
+  PgmBandReader reader;
+  if (!reader.Open(input_file)) {
+    cout <<"Can't open file " << input_file << endl;
+    return false;
+  }
+  PgmBandWriter writer;
+  if (!writer.Open(output_file, reader.num_rows(), reader.num_columns(), reader.num_gray_levels())) {
+    cout << "Can't write to file " << output_file << endl;
+    return false;
+  }
+  Image<uint16_t> band;
+  while (reader.ReadBand(band_rows, 1, &band)) {
+    EdgeDetection(band.view());
+    // the halo rows saw zeros instead of their outer neighbors, so only the band itself is kept
+    if (!writer.WriteRows(band, reader.halo_above(), reader.band_rows())) return false;
+  }
+  return writer.Close();
+}
 
 /**
- * modifies image by applying sobel 3x3 edge detection mask 
- * @param an_image reference to the image
+ * Applies the sobel mask to one image file and writes the result
+ * @param input_file the gray level image
+ * @param output_file the edge image that gets written
+ * @param band_rows if not 0, the image is streamed band by band instead of being read whole
+ * @param an_image reference to the image buffer, reused from one file to the next
+ * @return bool true if the image was read and written successfully
  */
-void EdgeDetection(Image *an_image){
+bool EdgeDetectionFile(const string &input_file, const string &output_file, size_t band_rows, Image<uint16_t> *an_image){
   if (an_image == nullptr) abort();
-  int rows = an_image->num_rows();
-  int cols = an_image->num_columns();
+  if (band_rows > 0) {
+    return StreamEdgeDetection(input_file, output_file, band_rows);
+  }
 
-  std::vector<int> gradient_magnitude;
+  if (!ReadImage(input_file, an_image)) {
+    cout <<"Can't open file " << input_file << endl;
+    return false;
+  }
 
-  int gradient_magnitude_height = rows + 2;
-  int gradient_magnitude_width = cols + 2;
+  EdgeDetection(an_image->view());
 
-  for(int r = 1; r < rows+1; r++){
-    for(int c = 1; c < cols+1; c++){
-      int gradient = 0;
-      gradient += pow(sobel_deriv(an_image, true, r, c),2);
-      gradient += pow(sobel_deriv(an_image, false, r, c),2);
-      gradient = pow(gradient,0.5);
-      gradient_magnitude.push_back(gradient);
-    }
-  }
-  int ctr = 0;
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int gradient = gradient_magnitude.at(ctr);
-      ctr++;
-      an_image->SetPixel(r, c, gradient);
-    }
+  if (!WriteImage(output_file, *an_image)){
+    cout << "Can't write to file " << output_file << endl;
+    return false;
   }
+  return true;
 }
 
 int main(int argc, char **argv){
   
-  if (argc!=3) {
-    printf("Usage: %s input_gray_image.pgm output_gray_image_filename.pgm\n", argv[0]);
+  size_t band_rows = 0;
+  if ((argc!=3 && argc!=4) || (argc==4 && !ParseCount(argv[3], &band_rows))) {
+    printf("Usage: %s input_gray_image.pgm output_gray_image_filename.pgm [band_rows]\n", argv[0]);
+    printf("   or: %s input_directory_or_@list output_directory [band_rows]\n", argv[0]);
+    printf("   band_rows: a number of rows greater than 0, to stream the image that many rows at a time\n");
     return 0;
   }
   const string input_file(argv[1]);
   const string output_file(argv[2]);
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: every image of the input directory (or list) goes through the mask into the output directory,
+  // in parallel, each worker reusing its own image buffer
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    if (!inputs.Open(input_file) || !MakeDirectory(output_file)) return 0;
+    ThreadPool pool;
+    vector<Image<uint16_t>> images(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      return EdgeDetectionFile(image_file, OutputFilename(output_file, Stem(image_file), ".pgm"), band_rows, &images[worker]);
+    });
     return 0;
   }
 
-  EdgeDetection(&an_image);
-
-  if (!WriteImage(output_file, an_image)){
-    cout << "Can't write to file " << output_file << endl;
-    return 0;
-  }
+  Image<uint16_t> an_image;
+  EdgeDetectionFile(input_file, output_file, band_rows, &an_image);
 }
@@ -4,9 +4,11 @@
 // The hough image and bucketed hough image are then written to new pgm images under the given filenames
 
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -14,41 +16,93 @@
 using namespace std;
 using namespace ComputerVisionProjects;
 
+/**
+ * takes an empty hough space image for an image of the given size from the pool
+ * @param rows number of rows of the image
+ * @param cols number of columns of the image
+ * @param rho_sample the rho step, how much rho should increment
+ * @param theta_sample the theta step, how much theta should increment
+ * @param pool the pool the hough image is taken from
+ */
+Image<int32_t> EmptyHoughImage(int rows, int cols, int rho_sample, double theta_sample, ImagePool<int32_t> *pool){
+  if (pool == nullptr) abort();
+  int max_rho = round(pow(pow(rows, 2) + pow(cols, 2), 0.5));
+  double max_theta = 2*M_PI;
+  int hough_rows = round(max_rho/rho_sample);
+  int hough_cols = round(max_theta/theta_sample);
+
+  return pool->Acquire(hough_rows, hough_cols);
+}
+
+/**
+ * adds the votes of the edge pixel at row r and column c to the hough image
+ * @param r row of the edge pixel
+ * @param c column of the edge pixel
+ * @param rho_sample the rho step, how much rho should increment
+ * @param theta_sample the theta step, how much theta should increment
+ * @param hough_image reference to the hough image which gets modified
+ * @param max_vote reference to the largest vote so far
+ */
+void Vote(int r, int c, int rho_sample, double theta_sample, Image<int32_t> *hough_image, int *max_vote){
+  int hough_rows = hough_image->num_rows();
+  int hough_cols = hough_image->num_columns();
+  for(int i = 0; i < hough_cols; i ++){
+    double rho = r*cos(i*theta_sample) + c*sin(i*theta_sample);
+    int rho_row = round(rho/rho_sample);
+    if(rho_row < hough_rows && rho_row >= 0){
+      int color = hough_image->GetPixel(rho_row, i) + 1;
+      hough_image->SetPixel(rho_row, i, color);
+      *max_vote = max(*max_vote, color);
+    }
+  }
+}
+
 /**
  * given an image, it calculates and return the hough space image
  * @param an_image reference to the image which gets modified
  * @param rho_sample the rho step, how much rho should increment
  * @param theta_sample the theta step, how much theta should increment
+ * @param pool the pool the hough image is taken from
  */
-Image *Accumulator(const Image *an_image, int rho_sample, double theta_sample){
+Image<int32_t> Accumulator(const Image<uint8_t> *an_image, int rho_sample, double theta_sample, ImagePool<int32_t> *pool){
   if (an_image == nullptr) abort();
   int rows = an_image->num_rows();
   int cols = an_image->num_columns();
   
-  int max_rho = round(pow(pow(rows, 2) + pow(cols, 2), 0.5));
-  double max_theta = 2*M_PI;
-  int hough_rows = round(max_rho/rho_sample);
-  int hough_cols = round(max_theta/theta_sample);
-
-  Image *HoughImage = new Image();
-  HoughImage->AllocateSpaceAndSetSize(hough_rows, hough_cols);
+  Image<int32_t> HoughImage = EmptyHoughImage(rows, cols, rho_sample, theta_sample, pool);
   int max_vote = 0;
   for(int r = 0; r < rows; r++){
     for(int c = 0; c < cols; c++){
       if(an_image->GetPixel(r,c) == 255){
-        for(int i = 0; i < hough_cols; i ++){
-          double rho = r*cos(i*theta_sample) + c*sin(i*theta_sample);
-          int rho_row = round(rho/rho_sample);
-          if(rho_row < hough_rows && rho_row >= 0){
-            int color = HoughImage->GetPixel(rho_row, i) + 1;
-            HoughImage->SetPixel(rho_row, i, color);
-            max_vote = max(max_vote, color);
-          }
-        }
+        Vote(r, c, rho_sample, theta_sample, &HoughImage, &max_vote);
       }
     }
   }
-  HoughImage->SetNumberGrayLevels(max_vote);
+  HoughImage.SetNumberGrayLevels(max_vote);
+  return HoughImage;
+}
+
+/**
+ * given a packed binary image, it calculates and return the hough space image
+ * the edge pixels are found a 64 pixel word at a time
+ * @param an_image reference to the binary image
+ * @param rho_sample the rho step, how much rho should increment
+ * @param theta_sample the theta step, how much theta should increment
+ * @param pool the pool the hough image is taken from
+ */
+Image<int32_t> Accumulator(const BinaryImage *an_image, int rho_sample, double theta_sample, ImagePool<int32_t> *pool){
+  if (an_image == nullptr) abort();
+  int rows = an_image->num_rows();
+  int cols = an_image->num_columns();
+
+  Image<int32_t> HoughImage = EmptyHoughImage(rows, cols, rho_sample, theta_sample, pool);
+  int max_vote = 0;
+  for(int r = 0; r < rows; r++){
+    for(int c = an_image->NextForeground(r, 0); c < cols; c = an_image->NextForeground(r, c+1)){
+      Vote(r, c, rho_sample, theta_sample, &HoughImage, &max_vote);
+    }
+  }
+  HoughImage.SetNumberGrayLevels(max_vote);
   return HoughImage;
 }
 
@@ -58,62 +112,111 @@ Image *Accumulator(const Image *an_image, int rho_sample, double theta_sample){
  * @param bucket_size determines height and width of bucket
  *        - from testing, leaving out this function or just setting bucket_size to 1 is best
  *        - values larger than 1 may lead to inaccurate results down the line
+ * @param pool the pool the bucketed image is taken from
+ * @param integral reference to the integral image buffer the bucket sums are read from
  */
-Image *BucketedImage(const Image *hough_image, int bucket_size){
-  if (hough_image == nullptr) abort();
+Image<int32_t> BucketedImage(const Image<int32_t> *hough_image, int bucket_size, ImagePool<int32_t> *pool, IntegralImage *integral){
+  if (hough_image == nullptr || pool == nullptr || integral == nullptr) abort();
   int hough_rows = hough_image->num_rows();
   int hough_cols = hough_image->num_columns();
 
-  Image *Bucketed = new Image();
-  Bucketed->AllocateSpaceAndSetSize(hough_rows/bucket_size, hough_cols/bucket_size);
+  Image<int32_t> Bucketed = pool->Acquire(hough_rows/bucket_size, hough_cols/bucket_size);
+  // every bucket sum is read from the summed-area table of the votes, whatever the bucket size
+  integral->Compute(hough_image->view());
   int max_vote = 0;
   for (int r = 0; r < hough_rows; r += bucket_size){
     for (int c = 0; c < hough_cols; c += bucket_size){
-      int total_bucket_votes = 0;
       int bucket_rows = min(r + bucket_size, hough_rows); 
       int bucket_cols = min(c + bucket_size, hough_cols);
       int bucket_row = bucket_rows/bucket_size -1;
       int bucket_col = bucket_cols/bucket_size -1;
       //BUCKET
-      for(int br = r; br < bucket_rows; br ++){
-        for(int bc = c; bc < bucket_cols; bc ++){
-          total_bucket_votes += hough_image->GetPixel(br,bc);
-        }
-      }
-      Bucketed->SetPixel(bucket_row, bucket_col, total_bucket_votes);
+      int total_bucket_votes = integral->Sum(r, c, bucket_rows, bucket_cols);
+      Bucketed.SetPixel(bucket_row, bucket_col, total_bucket_votes);
       max_vote = max(max_vote, total_bucket_votes);
     }
   }
-  Bucketed->SetNumberGrayLevels(max_vote);
+  Bucketed.SetNumberGrayLevels(max_vote);
   return Bucketed;
 }
 
+/**
+ * Computes the hough space of one binary image file and writes it along with its bucketed version
+ * @param input_file the binary image (.pgm or .pbm)
+ * @param output_image_file the hough image that gets written
+ * @param output_voting_file the bucketed hough image that gets written
+ * @param pool the pool the vote accumulators are taken from and returned to
+ * @param an_image reference to the image buffer for .pgm inputs, reused from one file to the next
+ * @param binary_image reference to the image buffer for .pbm inputs, reused from one file to the next
+ * @param integral reference to the integral image buffer of the buckets, reused from one file to the next
+ * @return bool true if the image was read and both images written successfully
+ */
+bool HoughFile(const string &input_file, const string &output_image_file, const string &output_voting_file, ImagePool<int32_t> *pool, Image<uint8_t> *an_image, BinaryImage *binary_image, IntegralImage *integral){
+  if (pool == nullptr || an_image == nullptr || binary_image == nullptr || integral == nullptr) abort();
+  int bucket_size = 1;
+  Image<int32_t> hough_image;
+  if (IsPbmFilename(input_file)) {
+    if (!ReadBinaryImage(input_file, binary_image)) {
+      cout <<"Can't open file " << input_file << endl;
+      return false;
+    }
+    hough_image = Accumulator(binary_image, 1, M_PI/180, pool);
+  } else {
+    if (!ReadImage(input_file, an_image)) {
+      cout <<"Can't open file " << input_file << endl;
+      return false;
+    }
+    hough_image = Accumulator(an_image, 1, M_PI/180, pool);
+  }
+  Image<int32_t> bucket_image = BucketedImage(&hough_image, bucket_size, pool, integral);
+
+  bool written = true;
+  if (!WriteImage(output_image_file, hough_image)){
+    cout << "Can't write to file " << output_image_file << endl;
+    written = false;
+  } else if (!WriteImage(output_voting_file, bucket_image)){
+    cout << "Can't write to file " << output_voting_file << endl;
+    written = false;
+  }
+  pool->Release(&hough_image);
+  pool->Release(&bucket_image);
+  return written;
+}
+
 int main(int argc, char **argv){
   
   if (argc!=4) {
-    printf("Usage: %s input_binary_image.pgm output_hough_image_filename.pgm voting_array\n", argv[0]);
+    printf("Usage: %s input_binary_image(.pgm or .pbm) output_hough_image_filename.pgm voting_array\n", argv[0]);
+    printf("   or: %s input_directory_or_@list hough_image_directory voting_array_directory\n", argv[0]);
     return 0;
   }
   const string input_file(argv[1]);
   const string output_image_file(argv[2]);
   const string output_voting_file(argv[3]);
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: the hough space of every image of the input directory (or list) is computed in parallel,
+  // each worker keeping its own pool of accumulators and its own input buffers
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    if (!inputs.Open(input_file) || !MakeDirectory(output_image_file) || !MakeDirectory(output_voting_file)) return 0;
+    ThreadPool pool;
+    vector<unique_ptr<ImagePool<int32_t>>> pools;
+    for (size_t w = 0; w < pool.num_threads(); ++w) pools.emplace_back(new ImagePool<int32_t>(true));
+    vector<Image<uint8_t>> images(pool.num_threads());
+    vector<BinaryImage> binary_images(pool.num_threads());
+    vector<IntegralImage> integrals(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      return HoughFile(image_file, OutputFilename(output_image_file, stem, ".pgm"), OutputFilename(output_voting_file, stem, ".pgm"), pools[worker].get(), &images[worker], &binary_images[worker], &integrals[worker]);
+    });
     return 0;
   }
-  
-  int bucket_size = 1;
-  Image *hough_image = Accumulator(&an_image, 1, M_PI/180);
-  Image *bucket_image = BucketedImage(hough_image, bucket_size);
 
-  if (!WriteImage(output_image_file, *hough_image)){
-    cout << "Can't write to file " << output_image_file << endl;
-    return 0;
-  }
-  if (!WriteImage(output_voting_file, *bucket_image)){
-    cout << "Can't write to file " << output_voting_file << endl;
-    return 0;
-  }
+  // the vote accumulators are large, so they are backed by huge pages where available
+  ImagePool<int32_t> pool(true);
+  Image<uint8_t> an_image;
+  BinaryImage binary_image;
+  IntegralImage integral;
+  HoughFile(input_file, output_image_file, output_voting_file, &pool, &an_image, &binary_image, &integral);
 }
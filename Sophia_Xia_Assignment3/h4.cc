@@ -7,9 +7,13 @@
 // the modified image is then written to the output filename provided
 
 #include "image.h"
+#include "batch.h"
+#include "labeling.h"
+#include <climits>
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -32,7 +36,7 @@ struct component{
  * @param an_image reference to the image
  * @return set<int> set of all labels of connected components
  */
-set<int> GetLabels(const Image *an_image){
+set<int> GetLabels(const Image<int32_t> *an_image){
   if (an_image == nullptr) abort();
   set<int> labels;
   int rows = an_image->num_rows();
@@ -57,18 +61,20 @@ set<int> GetLabels(const Image *an_image){
  * @param y0 y coordinate of first coordinate pair
  * @param x1 x coordinate of second coordinate pair
  * @param y1 y coordinate of second coordinate pair
- * @return vector<int> contains all points on the line in the form of {x0, y0, x1, y1, ... , xn, yn} 
+ * @param points reference to the vector that receives all points on the line in the form of {x0, y0, x1, y1, ... , xn, yn}
+ *        it is cleared first, so one vector can be reused for many lines without reallocating
 */
-vector<int> GetLinePoints(int x0, int y0, int x1, int y1) {  
+void GetLinePoints(int x0, int y0, int x1, int y1, vector<int> *points) {  
+  if (points == nullptr) abort();
   #ifdef SWAP
   #undef SWAP
   #endif
   #define SWAP(a,b) {a^=b; b^=a; a^=b;}
-  vector<int> points;
+  points->clear();
   const int DIR_X = 0;
   const int DIR_Y = 1;
-  // Increments: East, North-East, South, South-East, North.
-  int incrE, incrNE, incrS, incrSE, incrN;     
+  // Increments: East, North-East, South-East.
+  int incrE, incrNE, incrSE;     
   int d;         /* the D */
   int x,y;       /* running coordinates */
   int mpCase;    /* midpoint algorithm's case */
@@ -131,8 +137,8 @@ vector<int> GetLinePoints(int x0, int y0, int x1, int y1) {
   done = 0;
 
   while (!done) {
-    points.push_back(x);
-    points.push_back(y);
+    points->push_back(x);
+    points->push_back(y);
     // Move to the next point.
     switch(dir) {
       case DIR_X: 
@@ -197,7 +203,6 @@ vector<int> GetLinePoints(int x0, int y0, int x1, int y1) {
         break;    
     }
   }
-  return points;
 }
 
 /**
@@ -206,7 +211,7 @@ vector<int> GetLinePoints(int x0, int y0, int x1, int y1) {
  * @param components reference to the image containing the labeled connected components
  * @return vector<int> vector of rho theta coordinate pairs {rho_0, theta_0, rho_1, theta_1 ... rho_n, theta_n} 
 */
-vector<double> FindHoughLines(const Image *hough_image, const Image *components){
+vector<double> FindHoughLines(const Image<int32_t> *hough_image, const Image<int32_t> *components){
   if (hough_image == nullptr || components == nullptr) abort();
   int rows = hough_image->num_rows();
   int cols = hough_image->num_columns();
@@ -240,83 +245,42 @@ vector<double> FindHoughLines(const Image *hough_image, const Image *components)
 }
 
 /**
- * Modifies an image by making it binary based on a threshold
- * @param an_image reference to the image which gets modified
+ * Modifies an image, or a region of it, by making it binary based on a threshold
+ * @param an_image view of the pixels which get modified
  * @param threshold
  */
-void AboveThreshold(Image *an_image, int threshold){
-  if (an_image == nullptr) abort();
-  int rows = an_image->num_rows();
-  int cols = an_image->num_columns();
+void AboveThreshold(ImageView<int32_t> an_image, int threshold){
+  int rows = an_image.num_rows();
+  int cols = an_image.num_columns();
 
+  // the pixels of at least threshold are the ones above threshold-1, and every pixel is at least INT_MIN
   for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int color = an_image->GetPixel(r,c);
-      if(color < threshold)an_image->SetPixel(r,c,0);
-      else an_image->SetPixel(r,c,255);
-    }
+    int32_t *pixels = an_image.row(r);
+    if (threshold == INT_MIN) fill(pixels, pixels + cols, 255);
+    else ThresholdPixels(pixels, cols, threshold - 1);
   }
 }
 
 /**
  * Modifies a binary image by finding and labeling the connected components
  * adapted from my assignment 2 p2.cc code
+ * @param threads the threads that label strips of the image in parallel, or nullptr to label it on this thread
  * @param an_image reference to the image which gets modified
  */
-void ConnectedComponents(Image *an_image){
+void ConnectedComponents(ThreadPool *threads, Image<int32_t> *an_image){
   if (an_image == nullptr) abort();
-  int rows = an_image->num_rows();
-  int cols = an_image->num_columns();
-
-  // equiv: key=label, value=equivalent label
-  map<int, int> equiv;
-
-  int label = 0;
   // First Pass
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      if (an_image->GetPixel(r,c) == 255){
-        int upper = (r-1 >= 0) ? an_image->GetPixel(r-1,c) : 0;
-        int left = (c-1 >= 0) ? an_image->GetPixel(r,c-1) : 0;
-        int upper_left = (r-1 >= 0 && c-1 >= 0) ? an_image->GetPixel(r-1,c-1) : 0;
-        if(upper == 0 && left == 0 && upper_left == 0){
-          label ++;
-          equiv[label] = label;
-          an_image->SetPixel(r,c,equiv[label]);
-        }else if(upper != 0 && left != 0){
-          equiv[left] = equiv[upper];
-          an_image->SetPixel(r,c,equiv[left]);
-        }else if(left != 0){
-          an_image->SetPixel(r,c,equiv[left]);
-        }else if(upper != 0){
-          an_image->SetPixel(r,c,equiv[upper]);
-        }else if(upper_left != 0){
-          an_image->SetPixel(r,c,equiv[upper_left]);
-        }
-      }
-    }
-  }
-  // components: key=label, value=color
-  map<int, int> components;
-  for(auto const& x: equiv){
-    equiv[x.first] = equiv[x.second]; // necessary just in case any equivalencies slipped through and didn't get resolved
-    components[x.second] = 255; // only want values of the equiv map because the equivalencies are resolved there
-  }
-  // Calculating gray level for each component
-  int grays = 1;
-  for(auto const& x: components){
-    components[x.first] = grays;
-    grays += 1;
+  // each 2x2 block of foreground pixels takes the label of its neighbor blocks above and to the left (8-connectivity)
+  // and the equivalences between the labels are resolved, strips of rows being merged along their boundaries
+  ComponentLabeler<8> labeler;
+  size_t num_components = labeler.Label(an_image, threads);
+  // each component is numbered 1, 2, ...
+  vector<int32_t> colors(num_components+1);
+  for(size_t label = 0; label <= num_components; label++){
+    colors[label] = label;
   }
   // Second Pass to resolve equivalences
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int pixel = an_image->GetPixel(r,c);
-      if (pixel > 0){
-        an_image->SetPixel(r, c, components[equiv[pixel]]);
-      }
-    }
-  }
+  labeler.Relabel(colors, an_image, threads);
 }
 
 /**
@@ -361,16 +325,19 @@ vector<int> PolarToCartesian(int rows, int cols, double rho, double theta){
  * @param an_image reference to the image that gets modified
  * @param vector<int> vector of rho theta coordinate pairs {rho_0, theta_0, rho_1, theta_1 ... rho_n, theta_n}  
  */
-void DrawHoughLines(Image *an_image, vector<double> houghlines){
+void DrawHoughLines(Image<uint8_t> *an_image, vector<double> houghlines){
   if (an_image == nullptr) abort();
   int rows = an_image->num_rows();
   int cols = an_image->num_columns();
-  for(int i = 0; i < houghlines.size(); i += 2){
+  // all lines are collected first and then drawn in one batch
+  vector<int> lines;
+  for(size_t i = 0; i < houghlines.size(); i += 2){
     double rho = houghlines[i];
     double theta = houghlines[i+1];
     vector<int> coords = PolarToCartesian(rows, cols, rho, theta);
-    if(coords.size() == 4) DrawLine(coords[0], coords[1], coords[2], coords[3], 255, an_image);
+    if(coords.size() == 4) lines.insert(lines.end(), coords.begin(), coords.end());
   }
+  DrawLines(lines, 255, an_image);
 }
 
 /**
@@ -381,21 +348,24 @@ void DrawHoughLines(Image *an_image, vector<double> houghlines){
  * @param gap_tolerance how long a gap in the line segment can be
  * @param min_length minimum length of the lines
  */
-void DrawTrimmedHoughLines(Image *an_image, const Image *edge_image, vector<double> houghlines, int gap_tolerance, int min_length){
+void DrawTrimmedHoughLines(Image<uint8_t> *an_image, const Image<uint8_t> *edge_image, vector<double> houghlines, int gap_tolerance, int min_length){
   if (an_image == nullptr) abort();
   int rows = an_image->num_rows();
   int cols = an_image->num_columns();
-  for(int i = 0; i < houghlines.size(); i += 2){
+  vector<int> points;
+  // the trimmed segments are collected first and then drawn in one batch
+  vector<int> segments;
+  for(size_t i = 0; i < houghlines.size(); i += 2){
     double rho = houghlines[i];
     double theta = houghlines[i+1];
     vector<int> coords = PolarToCartesian(rows, cols, rho, theta);
     if(coords.size() == 4){
-      vector<int> points = GetLinePoints(coords[0], coords[1], coords[2], coords[3]);
+      GetLinePoints(coords[0], coords[1], coords[2], coords[3], &points);
       int x0 = -1; int y0 = -1;
       int x1 = -1; int y1 = -1;
       int line_length = 0;
       int gap = 0;
-      for(int j = 0; j < points.size(); j += 2){
+      for(size_t j = 0; j < points.size(); j += 2){
         int color = edge_image->GetPixel(points[j],points[j+1]);
         if(color == 255){
           if(x0 == -1){
@@ -416,7 +386,7 @@ void DrawTrimmedHoughLines(Image *an_image, const Image *edge_image, vector<doub
           if(x0 != -1) gap ++;
           if(gap > gap_tolerance){
             if(line_length > min_length){
-              DrawLine(x0, y0, x1, y1, 255, an_image);
+              segments.insert(segments.end(), {x0, y0, x1, y1});
             }
             x0 = -1; y0 = -1;
             x1 = -1; y1 = -1;
@@ -427,67 +397,109 @@ void DrawTrimmedHoughLines(Image *an_image, const Image *edge_image, vector<doub
       }
     }
   }
+  DrawLines(segments, 255, an_image);
 }
 
-int main(int argc, char **argv){
-
-  if (argc!=5 && argc!=6) {
-    printf("Usage: %s input_gray_image.pgm voting_array threshold output_gray_image_filename.pgm binary_edges.pgm(optional for line trimming)\n", argv[0]);
-    return 0;
-  }
-  const string input_file(argv[1]);
-  const string voting_array_file(argv[2]);
-  const string threshold(argv[3]);
-  const string output_file(argv[4]);
-  
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
+/**
+ * Finds the hough lines of one image from its voting array and writes the image with the lines drawn on it
+ * @param input_file the gray level image the lines are drawn on
+ * @param voting_array_file the hough image of input_file
+ * @param threshold the minimum number of votes of a line
+ * @param output_file the image that gets written
+ * @param binary_edges the binary edge image for line trimming, empty to draw whole lines
+ * @param pool the pool the components image is taken from and returned to
+ * @param threads the threads that label the components, or nullptr to label them on this thread
+ * @param an_image reference to the image buffer, reused from one file to the next
+ * @param hough_image reference to the hough image buffer, reused from one file to the next
+ * @param edge_image reference to the edge image buffer, reused from one file to the next
+ * @return bool true if the images were read and the result written successfully
+ */
+bool HoughLinesFile(const string &input_file, const string &voting_array_file, int threshold, const string &output_file, const string &binary_edges, ImagePool<int32_t> *pool, ThreadPool *threads, Image<uint8_t> *an_image, Image<int32_t> *hough_image, Image<uint8_t> *edge_image){
+  if (pool == nullptr || an_image == nullptr || hough_image == nullptr || edge_image == nullptr) abort();
+  if (!ReadImage(input_file, an_image)) {
     cout <<"Can't open file " << input_file << endl;
-    return 0;
+    return false;
   }
 
-  Image hough_image;
-  if (!ReadImage(voting_array_file, &hough_image)) {
+  if (!ReadImage(voting_array_file, hough_image)) {
     cout <<"Can't open file " << voting_array_file << endl;
-    return 0;
+    return false;
   }
 
-  // Deep copy hough_image into components
-  Image components;
-  int rows = hough_image.num_rows();
-  int cols = hough_image.num_columns();
-  components.AllocateSpaceAndSetSize(rows, cols);
+  // Deep copy hough_image into components, in a buffer from the pool
+  Image<int32_t> components = pool->Acquire(*hough_image);
   components.SetNumberGrayLevels(255);
-  for(int r = 0; r < rows; r++){
-    for(int c = 0; c < cols; c++){
-      int color = hough_image.GetPixel(r,c);
-      components.SetPixel(r,c,color);
-    }
-  }
   
-  AboveThreshold(&components, stoi(threshold));
+  AboveThreshold(components.view(), threshold);
   
-  ConnectedComponents(&components);
+  ConnectedComponents(threads, &components);
   
-  vector<double> hough_lines = FindHoughLines(&hough_image, &components);
+  vector<double> hough_lines = FindHoughLines(hough_image, &components);
+  pool->Release(&components);
 
   // If Binary Edge filename not provided draw regular Hough lines
-  if (argc == 5)
-    DrawHoughLines(&an_image, hough_lines);
+  if (binary_edges.empty())
+    DrawHoughLines(an_image, hough_lines);
   
   // If Binary Edge filename provided draw trimmed Hough Lines
-  if (argc == 6){
-    const string binary_edges(argv[5]);
-    Image edge_image;
-    if (!ReadImage(binary_edges, &edge_image)) {
+  else {
+    if (!ReadImage(binary_edges, edge_image)) {
       cout <<"Can't open file " << binary_edges << endl;
-      return 0;
+      return false;
     }
-    DrawTrimmedHoughLines(&an_image, &edge_image, hough_lines, 10, 50);
+    DrawTrimmedHoughLines(an_image, edge_image, hough_lines, 10, 50);
   }
 
-  if (!WriteImage(output_file, an_image)){
+  if (!WriteImage(output_file, *an_image)){
     cout << "Can't write to file " << output_file << endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv){
+
+  if (argc!=5 && argc!=6) {
+    printf("Usage: %s input_gray_image.pgm voting_array threshold output_gray_image_filename.pgm binary_edges.pgm(optional for line trimming)\n", argv[0]);
+    printf("   or: %s input_directory_or_@list voting_array_directory threshold output_directory binary_edges_directory(optional)\n", argv[0]);
     return 0;
   }
+  const string input_file(argv[1]);
+  const string voting_array_file(argv[2]);
+  const string threshold(argv[3]);
+  const string output_file(argv[4]);
+  const string binary_edges = (argc == 6) ? argv[5] : "";
+
+  // batch mode: the lines of every image of the input directory (or list) are drawn in parallel,
+  // its voting array (and edge image) being the file with the same name in the other directories
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    BatchInput voting_arrays;
+    BatchInput edges;
+    if (!inputs.Open(input_file) || !voting_arrays.Open(voting_array_file) || !MakeDirectory(output_file)) return 0;
+    if (!binary_edges.empty() && !edges.Open(binary_edges)) return 0;
+    ThreadPool pool;
+    vector<unique_ptr<ImagePool<int32_t>>> pools;
+    for (size_t w = 0; w < pool.num_threads(); ++w) pools.emplace_back(new ImagePool<int32_t>(true));
+    vector<Image<uint8_t>> images(pool.num_threads());
+    vector<Image<int32_t>> hough_images(pool.num_threads());
+    vector<Image<uint8_t>> edge_images(pool.num_threads());
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      string frame_voting_array;
+      string frame_edges;
+      if (!voting_arrays.Find(stem, &frame_voting_array)) return false;
+      if (!binary_edges.empty() && !edges.Find(stem, &frame_edges)) return false;
+      return HoughLinesFile(image_file, frame_voting_array, stoi(threshold), OutputFilename(output_file, stem, ".pgm"), frame_edges, pools[worker].get(), nullptr, &images[worker], &hough_images[worker], &edge_images[worker]);
+    });
+    return 0;
+  }
+
+  ImagePool<int32_t> pool(true);
+  ThreadPool threads;
+  Image<uint8_t> an_image;
+  Image<int32_t> hough_image;
+  Image<uint8_t> edge_image;
+  HoughLinesFile(input_file, voting_array_file, stoi(threshold), output_file, binary_edges, &pool, &threads, &an_image, &hough_image, &edge_image);
 }
@@ -0,0 +1,292 @@
+// Labeling of the connected components of binary images, serially or
+// in parallel strips, with the equivalences between provisional labels
+// kept in a union-find.
+// Sample usage:
+//   ComponentLabeler<8> labeler;
+//   size_t num_components = labeler.Label(&an_image, &pool);
+//   vector<int32_t> colors(num_components + 1);
+//   ...
+//   labeler.Relabel(colors, &an_image, &pool);
+
+#ifndef COMPUTER_VISION_LABELING_H_
+#define COMPUTER_VISION_LABELING_H_
+
+#include "batch.h"
+#include "image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ComputerVisionProjects {
+
+// Disjoint sets of the labels 1, 2, ... in flat arrays indexed by label,
+// with path compression and union by rank, so that any sequence of
+// operations takes (almost) linear time.
+class UnionFind {
+ public:
+  // Space for expected_labels is reserved up front; past it the arrays
+  // grow geometrically.
+  explicit UnionFind(size_t expected_labels = 0) { Reset(expected_labels); }
+
+  // Removes all the labels, keeping the space of the arrays.
+  void Reset(size_t expected_labels = 0);
+
+  // Adds a label in a set of its own and returns it: 1, 2, ...
+  int32_t NewLabel() {
+    const int32_t label = parents_.size();
+    parents_.push_back(label);
+    ranks_.push_back(0);
+    return label;
+  }
+
+  size_t num_labels() const { return parents_.size() - 1; }
+
+  // Returns the representative label of the set of label.
+  int32_t Find(int32_t label) {
+    // Path halving: every other label on the way up skips its parent.
+    while (parents_[label] != label) {
+      parents_[label] = parents_[parents_[label]];
+      label = parents_[label];
+    }
+    return label;
+  }
+
+  // Merges the sets of labels a and b; returns the representative label
+  // of the merged set.
+  int32_t Union(int32_t a, int32_t b);
+
+  // Numbers the sets 1, 2, ... in the order of their smallest labels
+  // (for labels handed out in raster order, the order in which the
+  // components are first met). Sets final_labels[label] to the number of
+  // the set of every label, final_labels[0] to 0.
+  // Returns the number of sets.
+  size_t Flatten(std::vector<int32_t> *final_labels);
+
+ private:
+  // parents_[label] is label for a representative; entry 0 is unused.
+  std::vector<int32_t> parents_;
+  // Upper bound on the height of the tree of each representative.
+  std::vector<uint8_t> ranks_;
+};
+
+// The raw moments of a set of pixels: its area and the sums of the rows
+// and columns of its pixels and of their products up to the third order,
+// along with its bounding box and perimeter, which add up the same way.
+// The sums up to the second order are exact in 64 bits for any image that
+// fits in memory. The third-order ones are kept modulo 2^64: the moments
+// about a point of the set, which are much smaller, still come out exact.
+// The perimeter is the number of pixel sides between the set and the
+// rest of the image: 4 per pixel, less 2 per pair of 4-neighbors within
+// the set, which are counted with AddSharedEdges().
+struct RawMoments {
+  RawMoments(): area{0}, sum_rows{0}, sum_columns{0}, sum_rows_squared{0},
+		sum_rows_columns{0}, sum_columns_squared{0}, sum_rows_cubed{0},
+		sum_rows_squared_columns{0}, sum_rows_columns_squared{0},
+		sum_columns_cubed{0}, perimeter{0}, first_row{INT64_MAX},
+		last_row{-1}, first_column{INT64_MAX}, last_column{-1} { }
+
+  void Add(int64_t row, int64_t column) {
+    ++area;
+    sum_rows += row;
+    sum_columns += column;
+    sum_rows_squared += row * row;
+    sum_rows_columns += row * column;
+    sum_columns_squared += column * column;
+    const uint64_t r = row;
+    const uint64_t c = column;
+    sum_rows_cubed += r * r * r;
+    sum_rows_squared_columns += r * r * c;
+    sum_rows_columns_squared += r * c * c;
+    sum_columns_cubed += c * c * c;
+    perimeter += 4;
+    if (row < first_row) first_row = row;
+    if (row > last_row) last_row = row;
+    if (column < first_column) first_column = column;
+    if (column > last_column) last_column = column;
+  }
+
+  // Adds the pixels of columns [first_column, end_column) of row, with
+  // the closed forms of the sums of consecutive integers, squares and
+  // cubes. The pixels of the run are 4-neighbors of each other.
+  void AddRun(int64_t row, int64_t first_column, int64_t end_column);
+
+  // Takes count pairs of 4-neighbors within the set off the perimeter.
+  void AddSharedEdges(int64_t count) { perimeter -= 2 * count; }
+
+  void Add(const RawMoments &other);
+
+  int64_t area;
+  int64_t sum_rows;
+  int64_t sum_columns;
+  int64_t sum_rows_squared;
+  int64_t sum_rows_columns;
+  int64_t sum_columns_squared;
+  uint64_t sum_rows_cubed;
+  uint64_t sum_rows_squared_columns;
+  uint64_t sum_rows_columns_squared;
+  uint64_t sum_columns_cubed;
+  int64_t perimeter;
+  // The bounding box, last row and column included; first_row is
+  // INT64_MAX and last_row -1 while the set is empty.
+  int64_t first_row;
+  int64_t last_row;
+  int64_t first_column;
+  int64_t last_column;
+};
+
+// Labels the kConnectivity-connected (4 or 8) components of the pixels of
+// value 255 of an image; all other pixels are background. The components
+// are numbered 1, 2, ... in the order a raster scan meets them.
+// With 8-connectivity the image is scanned in 2x2 blocks, whose
+// foreground pixels are always connected and share one provisional
+// label (Grana et al., "Optimized block-based connected components
+// labeling with decision trees"). With 4-connectivity the pixels of a
+// block need not be connected, and the image is scanned pixel by pixel.
+// With a pool, the image is cut in horizontal strips, one per worker:
+// every strip is labeled on its own, the strips are merged along their
+// boundaries, and the labels are replaced in parallel. The components
+// and their numbers are the same as with a single strip.
+template <int kConnectivity>
+class ComponentLabeler {
+  static_assert(kConnectivity == 4 || kConnectivity == 8,
+		"Components are 4- or 8-connected");
+
+ public:
+  ComponentLabeler(): num_components_{0} { }
+
+  // First pass: replaces every pixel of an_image by a provisional label
+  // (0 for the background) and resolves the equivalences between them.
+  // pool may be nullptr to label on this thread. Unless moments is
+  // nullptr, the raw moments of every provisional label are accumulated
+  // in the same scan and summed over the equivalences once they are
+  // resolved: (*moments)[c] is set to the raw moments of component c =
+  // 1..num_components(), entry 0 being unused.
+  // Returns the number of components.
+  size_t Label(Image<int32_t> *an_image, ThreadPool *pool,
+	       std::vector<RawMoments> *moments = nullptr);
+
+  // Second pass: sets every pixel of the image given to Label() to
+  // colors[c], c being the number of its component (0 for the
+  // background). colors must have num_components() + 1 entries.
+  void Relabel(const std::vector<int32_t> &colors, Image<int32_t> *an_image,
+	       ThreadPool *pool);
+
+  size_t num_components() const { return num_components_; }
+
+ private:
+  // The rows [first_row, end_row) of the image, labeled on their own.
+  struct Strip {
+    size_t first_row;
+    size_t end_row;
+    UnionFind equivalences;
+    // Number of the component, within the strip, of every provisional
+    // label of the strip.
+    std::vector<int32_t> components;
+    // Raster index, within the strip, of the first pixel of every
+    // provisional label handed out by a block; empty for 4-connectivity,
+    // whose labels are handed out in raster order.
+    std::vector<size_t> first_pixels;
+    // Raw moments of every provisional label, if asked for.
+    std::vector<RawMoments> moments;
+    // Label in merged_ of component 1 of the strip, less one.
+    int32_t first_label;
+  };
+
+  std::vector<Strip> strips_;
+  // The components of all the strips, merged along the boundaries.
+  UnionFind merged_;
+  // Final number of every label of merged_.
+  std::vector<int32_t> final_labels_;
+  size_t num_components_;
+};
+
+// Labels the kConnectivity-connected (4 or 8) components of the runs of
+// a run-length image: runs of consecutive rows are connected if they share
+// a column (4-connectivity) or if their columns are at most 1 apart
+// (8-connectivity). Sets (*run_labels)[k] to the component of run k of
+// the image, the components being numbered 1, 2, ... in the order a
+// raster scan meets them, as with ComponentLabeler. The work is
+// proportional to the number of runs, not of pixels. Unless moments is
+// nullptr, (*moments)[c] is set to the raw moments of component c, as
+// with ComponentLabeler::Label(), from the same scan of the runs.
+// Returns the number of components.
+template <int kConnectivity>
+size_t LabelRuns(const RunLengthImage &runs, std::vector<int32_t> *run_labels,
+		 std::vector<RawMoments> *moments = nullptr);
+
+// The raw moments of the labels 0, 1, ..., size() - 1 of a label image, as
+// in RawMoments, in an array of 64-bit sums per moment indexed by label (a
+// structure of arrays), so that looking a label up costs no more than
+// indexing.
+// Sample usage:
+//   MomentTable table;
+//   ComputeLabelMoments(labeled_image.view(), &pool, &table);
+//   for (size_t label = 1; label < table.size(); ++label)
+//     if (table.area(label) != 0) ... table.moments(label) ...
+class MomentTable {
+ public:
+  // Removes all the sums, then makes room for the labels below size.
+  void Reset(size_t size);
+
+  size_t size() const { return area_.size(); }
+
+  // Makes room for the labels up to label, keeping the sums.
+  void Reserve(int32_t label) {
+    if (static_cast<size_t>(label) >= size()) Grow(label);
+  }
+
+  // Adds the pixels of columns [first_column, end_column) of row to
+  // label, which must be below size().
+  void AddRun(int32_t label, int64_t row, int64_t first_column,
+	      int64_t end_column);
+
+  // Takes count pairs of 4-neighbors within label off its perimeter.
+  void AddSharedEdges(int32_t label, int64_t count) {
+    perimeter_[label] -= 2 * count;
+  }
+
+  // Adds the sums of other, e.g. those of another strip of the image.
+  void Add(const MomentTable &other);
+
+  int64_t area(int32_t label) const { return area_[label]; }
+  RawMoments moments(int32_t label) const;
+
+ private:
+  void Grow(int32_t label);
+
+  // Adds moments, e.g. those of a run, to label.
+  void AddMoments(int32_t label, const RawMoments &moments);
+
+  std::vector<int64_t> area_;
+  std::vector<int64_t> sum_rows_;
+  std::vector<int64_t> sum_columns_;
+  std::vector<int64_t> sum_rows_squared_;
+  std::vector<int64_t> sum_rows_columns_;
+  std::vector<int64_t> sum_columns_squared_;
+  std::vector<uint64_t> sum_rows_cubed_;
+  std::vector<uint64_t> sum_rows_squared_columns_;
+  std::vector<uint64_t> sum_rows_columns_squared_;
+  std::vector<uint64_t> sum_columns_cubed_;
+  std::vector<int64_t> perimeter_;
+  std::vector<int64_t> first_row_;
+  std::vector<int64_t> last_row_;
+  std::vector<int64_t> first_column_;
+  std::vector<int64_t> last_column_;
+};
+
+// Sets table to the raw moments of every positive label of a label image
+// (other values are background), in the coordinates of the view. Rows are
+// scanned as runs of equal labels, each added in closed form, and the
+// pixels of a run are only looked at one by one to find those whose upper
+// 4-neighbor has the same label, for the perimeters. With a
+// pool, every worker sums a horizontal strip into a table of its own,
+// and the tables are added up at the end. The table grows to the largest
+// label met.
+template <typename PixelType>
+void ComputeLabelMoments(ImageView<const PixelType> labels, ThreadPool *pool,
+			 MomentTable *table);
+
+}  // namespace ComputerVisionProjects
+
+#endif  // COMPUTER_VISION_LABELING_H_
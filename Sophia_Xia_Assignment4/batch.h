@@ -0,0 +1,127 @@
+// Batch processing support shared by the programs: a fixed-size pool of
+// worker threads, and the inputs of a batch run (a directory or a list
+// of files instead of a single file).
+// Sample usage:
+//   BatchInput inputs;
+//   if (!inputs.Open("input_directory")) ...
+//   ThreadPool pool;
+//   // One buffer per worker, reused for all the files it processes.
+//   vector<Image<uint8_t>> images(pool.num_threads());
+//   ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+//     return ReadImage(inputs.files()[i], &images[worker]) && ...;
+//   });
+
+#ifndef COMPUTER_VISION_BATCH_H_
+#define COMPUTER_VISION_BATCH_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ComputerVisionProjects {
+
+// A fixed number of worker threads, started once and kept waiting for
+// work. Worker w of num_threads() can keep its own buffers in slot w of
+// a vector, since a worker runs one task at a time.
+class ThreadPool {
+ public:
+  // num_threads 0 means the value of the CV_NUM_THREADS environment
+  // variable if set, otherwise one thread per core.
+  explicit ThreadPool(size_t num_threads = 0);
+
+  ThreadPool(const ThreadPool &pool) = delete;
+  ThreadPool& operator=(const ThreadPool &pool) = delete;
+
+  ~ThreadPool();
+
+  size_t num_threads() const { return workers_.size(); }
+
+  // Calls task(i, worker) for every i in [0, count), spread over the
+  // workers, and waits for all of them to finish.
+  // Returns the number of calls that returned false.
+  size_t ForEach(size_t count,
+		 const std::function<bool(size_t, size_t)> &task);
+
+ private:
+  void Work(size_t worker);
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  // The current ForEach() call: its task, the next index to hand out,
+  // and the number of workers still busy with it.
+  const std::function<bool(size_t, size_t)> *task_;
+  size_t count_;
+  size_t next_;
+  size_t busy_workers_;
+  size_t failures_;
+  // Incremented by every ForEach() call, so that workers notice new work.
+  size_t generation_;
+  bool stopping_;
+};
+
+// The files named by one command line argument:
+//  - a directory: all of its files, sorted by name;
+//  - @list_file: the files listed in list_file, one per line;
+//  - anything else: that single file.
+// The first two make a batch; a single file is shared by every frame of
+// a batch (e.g. one directions file for many image triples).
+class BatchInput {
+ public:
+  BatchInput(): is_batch_{false} { }
+
+  // Fails if two files of a batch have the same stem (see Stem()), as
+  // their outputs would have the same name.
+  // Returns true if  everyhing is OK, false otherwise.
+  bool Open(const std::string &argument);
+
+  bool is_batch() const { return is_batch_; }
+  const std::vector<std::string> &files() const { return files_; }
+
+  // Sets filename to the file of the batch whose stem (see Stem()) is
+  // stem, or to the single file. Returns false if there is none.
+  bool Find(const std::string &stem, std::string *filename) const;
+
+ private:
+  bool is_batch_;
+  std::vector<std::string> files_;
+  // The batch files by stem.
+  std::unordered_map<std::string, std::string> files_by_stem_;
+};
+
+// Calls process(i, worker) for every file i of inputs on the workers of
+// pool, then lists the files for which it returned false, in order.
+// Returns the number of those files.
+size_t ProcessBatch(ThreadPool *pool, const BatchInput &inputs,
+		    const std::function<bool(size_t, size_t)> &process);
+
+// Returns true if argument names a batch: a directory or an @list_file.
+bool IsBatchArgument(const std::string &argument);
+
+// Returns the name of filename without its directory and its extension,
+// e.g. "frame_007" for "input/frame_007.pgm".
+std::string Stem(const std::string &filename);
+
+// Returns directory/stem followed by extension.
+std::string OutputFilename(const std::string &directory,
+			   const std::string &stem,
+			   const std::string &extension);
+
+// Sets count to the number written in argument, e.g. a count given on
+// the command line. Returns false, leaving count unchanged, unless
+// argument is a whole number greater than 0.
+bool ParseCount(const std::string &argument, size_t *count);
+
+// Creates directory unless it already exists.
+// Returns true if  everyhing is OK, false otherwise.
+bool MakeDirectory(const std::string &directory);
+
+}  // namespace ComputerVisionProjects
+
+#endif  // COMPUTER_VISION_BATCH_H_
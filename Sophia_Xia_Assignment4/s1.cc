@@ -3,6 +3,7 @@
 // the center coordinates and radius of the sphere
 // the data calculated is then written to a textfile
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -19,7 +20,7 @@ using namespace ComputerVisionProjects;
  * @param threshold 
  * @param filename the name of the file the data should be written to
  */
-void DetectSphere(const Image *an_image, int threshold, string filename){
+void DetectSphere(const MappedImage *an_image, int threshold, string filename){
   if (an_image == nullptr) abort();
   int rows = an_image->num_rows();
   int cols = an_image->num_columns();
@@ -28,8 +29,9 @@ void DetectSphere(const Image *an_image, int threshold, string filename){
   int centery = 0;
   int area = 0;
   for(int r = 0; r < rows; r++){
+    const uint8_t *pixels = an_image->row(r);
     for(int c = 0; c < cols; c++){
-      if (threshold < an_image->GetPixel(r, c)){
+      if (threshold < pixels[c]){
         centerx += r;
         centery += c;
         area ++;
@@ -71,21 +73,47 @@ void DetectSphere(const Image *an_image, int threshold, string filename){
   database.close();
 }
 
+/**
+ * Detects the sphere of one image file and writes its parameters
+ * @param input_file the image that should depict a sphere
+ * @param threshold
+ * @param output_file the name of the file the parameters should be written to
+ * @return bool true if the image was read successfully
+ */
+bool SphereFile(const string &input_file, int threshold, const string &output_file){
+  MappedImage an_image;
+  if (!MapImage(input_file, &an_image)) {
+    cout <<"Can't open file " << input_file << endl;
+    return false;
+  }
+
+  DetectSphere(&an_image, threshold, output_file);
+  return true;
+}
+
 int main(int argc, char **argv){
   
   if (argc!=4) {
     printf("Usage: %s input_original_image.pgm input_threshold_value output_parameters_file.txt\n", argv[0]);
+    printf("   or: %s input_directory_or_@list input_threshold_value output_parameters_directory\n", argv[0]);
     return 0;
   }
   const string input_file(argv[1]);
   const string threshold(argv[2]);
   const string output_file(argv[3]);
 
-  Image an_image;
-  if (!ReadImage(input_file, &an_image)) {
-    cout <<"Can't open file " << input_file << endl;
+  // batch mode: the sphere of every image of the input directory (or list) is detected in parallel,
+  // its parameters going to the text file with the same name in the output directory
+  if (IsBatchArgument(input_file)) {
+    BatchInput inputs;
+    if (!inputs.Open(input_file) || !MakeDirectory(output_file)) return 0;
+    ThreadPool pool;
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t) -> bool {
+      const string &image_file = inputs.files()[i];
+      return SphereFile(image_file, stoi(threshold), OutputFilename(output_file, Stem(image_file), ".txt"));
+    });
     return 0;
   }
 
-  DetectSphere(&an_image, stoi(threshold), output_file);
+  SphereFile(input_file, stoi(threshold), output_file);
 }
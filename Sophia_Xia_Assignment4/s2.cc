@@ -5,6 +5,7 @@
 // this is done for 3 different sphere images under different lighting conditions
 // the vectors are then all written to a textfile
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -35,20 +36,20 @@ vector<int> ReadParameterFile(string filename){
  * @param an_image reference to the image that should depict a sphere
  * @return vector<int> vector of length 3 containing x coordinate, y coordinate, and pixel value
  */
-vector<int> BrightestPixel(const Image *an_image){
+vector<int> BrightestPixel(const MappedImage *an_image){
   if (an_image == nullptr) abort();
   int rows = an_image->num_rows();
   int cols = an_image->num_columns();
   int max_brightness = 0;
-  for(int r = 0; r < rows; r++)
-    for(int c = 0; c < cols; c++)
-      max_brightness = max(max_brightness, an_image->GetPixel(r, c));
+  for(uint8_t pixel: an_image->pixels())
+    max_brightness = max(max_brightness, static_cast<int>(pixel));
   int centerx = 0;
   int centery = 0;
   int area = 0;
   for(int r = 0; r < rows; r++){
+    const uint8_t *pixels = an_image->row(r);
     for(int c = 0; c < cols; c++){
-      if(an_image->GetPixel(r, c) == max_brightness){
+      if(pixels[c] == max_brightness){
         centerx += r;
         centery += c;
         area += 1;
@@ -67,7 +68,7 @@ vector<int> BrightestPixel(const Image *an_image){
  * @param image reference to the image that should depict a sphere
  * @return vector<double> contains x y and z components of the vector scaled to pixel brightness
  */
-vector<double> BrightestNormal(vector<int> parameters, const Image *image){
+vector<double> BrightestNormal(vector<int> parameters, const MappedImage *image){
   vector<int> brightest_pixel = BrightestPixel(image);
   int centerx = parameters[0];
   int centery = parameters[1];
@@ -84,32 +85,30 @@ vector<double> BrightestNormal(vector<int> parameters, const Image *image){
   return normal;
 }
 
-int main(int argc, char **argv){
-  
-  if (argc!=6) {
-    printf("Usage: %s input_parameters_file.txt image1.pgm image2.pgm image3.pgm output_directions_file.txt\n", argv[0]);
-    return 0;
-  }
-  const string input_parameters_file(argv[1]);
-  const string input_image_one(argv[2]);
-  const string input_image_two(argv[3]);
-  const string input_image_three(argv[4]);
-  const string output_file(argv[5]);
-
-  Image image_one;
-  if (!ReadImage(input_image_one, &image_one)) {
+/**
+ * Calculates the light source directions of one triple of sphere images and writes them
+ * @param input_parameters_file the parameters of the sphere
+ * @param input_image_one the sphere under the first light source
+ * @param input_image_two the sphere under the second light source
+ * @param input_image_three the sphere under the third light source
+ * @param output_file the name of the file the directions should be written to
+ * @return bool true if the images were read successfully
+ */
+bool DirectionsFile(const string &input_parameters_file, const string &input_image_one, const string &input_image_two, const string &input_image_three, const string &output_file){
+  MappedImage image_one;
+  if (!MapImage(input_image_one, &image_one)) {
     cout <<"Can't open file " << input_image_one << endl;
-    return 0;
+    return false;
   }
-  Image image_two;
-  if (!ReadImage(input_image_two, &image_two)) {
+  MappedImage image_two;
+  if (!MapImage(input_image_two, &image_two)) {
     cout <<"Can't open file " << input_image_two << endl;
-    return 0;
+    return false;
   }
-  Image image_three;
-  if (!ReadImage(input_image_three, &image_three)) {
+  MappedImage image_three;
+  if (!MapImage(input_image_three, &image_three)) {
     cout <<"Can't open file " << input_image_three << endl;
-    return 0;
+    return false;
   }
   // READ SPHERE PARAMETERS FROM FILE
   vector<int> parameters = ReadParameterFile(input_parameters_file);
@@ -124,4 +123,41 @@ int main(int argc, char **argv){
   database << normal_two[0] << " " << normal_two[1] << " " << normal_two[2] << "\n";
   database << normal_three[0] << " " << normal_three[1] << " " << normal_three[2] << "\n";
   database.close();
+  return true;
+}
+
+int main(int argc, char **argv){
+  
+  if (argc!=6) {
+    printf("Usage: %s input_parameters_file.txt image1.pgm image2.pgm image3.pgm output_directions_file.txt\n", argv[0]);
+    printf("   or: %s parameters_file_or_directory image1_directory_or_@list image2_file_or_directory image3_file_or_directory output_directions_directory\n", argv[0]);
+    return 0;
+  }
+  const string input_parameters_file(argv[1]);
+  const string input_image_one(argv[2]);
+  const string input_image_two(argv[3]);
+  const string input_image_three(argv[4]);
+  const string output_file(argv[5]);
+
+  // batch mode: one directions file per image of the first directory (or list), computed in parallel,
+  // the parameters and the other two images being the files with the same name in the other arguments
+  if (IsBatchArgument(input_image_one)) {
+    BatchInput inputs;
+    BatchInput parameters;
+    BatchInput images_two;
+    BatchInput images_three;
+    if (!inputs.Open(input_image_one) || !parameters.Open(input_parameters_file) || !images_two.Open(input_image_two) ||
+        !images_three.Open(input_image_three) || !MakeDirectory(output_file)) return 0;
+    ThreadPool pool;
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      string frame_parameters, frame_two, frame_three;
+      if (!parameters.Find(stem, &frame_parameters) || !images_two.Find(stem, &frame_two) || !images_three.Find(stem, &frame_three)) return false;
+      return DirectionsFile(frame_parameters, image_file, frame_two, frame_three, OutputFilename(output_file, stem, ".txt"));
+    });
+    return 0;
+  }
+
+  DirectionsFile(input_parameters_file, input_image_one, input_image_two, input_image_three, output_file);
 }
@@ -4,6 +4,7 @@
 // calculate and draw the normals at the specified intervals from three images
 // the image is then written to the specified file
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
@@ -89,9 +90,9 @@ vector<double> NormalVector(int value_a, int value_b, int value_c, vector<double
  * @param x the center x value of dot
  * @param y the center y value of dot
  */
-void DrawDot(Image *an_image, int x, int y){
-  size_t rows = an_image->num_rows();
-  size_t cols = an_image->num_columns();
+void DrawDot(Image<uint8_t> *an_image, int x, int y){
+  int rows = static_cast<int>(an_image->num_rows());
+  int cols = static_cast<int>(an_image->num_columns());
   an_image->SetPixel(x,y, 0);
   if(y-1 >= 0) an_image->SetPixel(x,y-1, 0);
   if(x-1 >= 0) an_image->SetPixel(x-1,y, 0);
@@ -105,24 +106,30 @@ void DrawDot(Image *an_image, int x, int y){
 
 /**
  * calculates and draws the normals on the image
+ * only the region of the object is visited, the normals are drawn in the coordinates of the first image
  * @param directions a vector of size 9 that contains 3 light source directions
  * @param one the first image that gets drawn on
- * @param two the second image
- * @param three the third image
+ * @param two view of the object region of the second image
+ * @param three view of the same region of the third image
  * @param step the interval to calculate and draw normals on the image
  * @param threshold
  * @return *Image reference to the modified first image
  */
-Image *DrawNeedleMap(vector<double> directions, Image *one, const Image *two, const Image *three, int step, int threshold){
-  if (one == nullptr || two == nullptr || three == nullptr) abort();
-  int rows = one->num_rows();
-  int cols = one->num_columns();
+Image<uint8_t> *DrawNeedleMap(vector<double> directions, Image<uint8_t> *one, ImageView<const uint8_t> two, ImageView<const uint8_t> three, int step, int threshold){
+  if (one == nullptr) abort();
+  int first_row = two.first_row();
+  int first_col = two.first_column();
+  int last_row = first_row + two.num_rows();
+  int last_col = first_col + two.num_columns();
   directions = inverse_matrix(directions);
-  for(int r = step; r < rows; r+=step){
-    for(int c = step; c < cols; c+=step){
+  // the first multiples of step inside the region, as if the whole image was stepped through from step
+  int start_r = max(step, (first_row + step - 1)/step*step);
+  int start_c = max(step, (first_col + step - 1)/step*step);
+  for(int r = start_r; r < last_row; r+=step){
+    for(int c = start_c; c < last_col; c+=step){
       int one_value = one->GetPixel(r,c);
-      int two_value = two->GetPixel(r,c);
-      int three_value = three->GetPixel(r,c);
+      int two_value = two.GetPixel(r-first_row,c-first_col);
+      int three_value = three.GetPixel(r-first_row,c-first_col);
       if(one_value > threshold && two_value > threshold && three_value > threshold){
         vector<double> normal = NormalVector(one_value,two_value,three_value, directions);
         DrawDot(one, r, c);
@@ -133,10 +140,55 @@ Image *DrawNeedleMap(vector<double> directions, Image *one, const Image *two, co
   return one;
 }
 
+/**
+ * Draws the needle map of one triple of images and writes it
+ * @param input_directions the light source directions
+ * @param input_image_one the first image, that gets drawn on
+ * @param input_image_two the second image
+ * @param input_image_three the third image
+ * @param step
+ * @param threshold
+ * @param output_image the name of the file the needle map should be written to
+ * @param images reference to the three image buffers, reused from one triple to the next
+ * @return bool true if the images were read and the needle map written successfully
+ */
+bool NeedleMapFile(const string &input_directions, const string &input_image_one, const string &input_image_two, const string &input_image_three, int step, int threshold, const string &output_image, vector<Image<uint8_t>> *images){
+  if (images == nullptr || images->size() != 3) abort();
+  Image<uint8_t> &image_one = (*images)[0];
+  if (!ReadImage(input_image_one, &image_one)) {
+    cout <<"Can't open file " << input_image_one << endl;
+    return false;
+  }
+  Image<uint8_t> &image_two = (*images)[1];
+  if (!ReadImage(input_image_two, &image_two)) {
+    cout <<"Can't open file " << input_image_two << endl;
+    return false;
+  }
+  Image<uint8_t> &image_three = (*images)[2];
+  if (!ReadImage(input_image_three, &image_three)) {
+    cout <<"Can't open file " << input_image_three << endl;
+    return false;
+  }
+
+  vector<double> directions = ReadDirectionFile(input_directions);
+  // no pixel outside of the object region can pass the threshold, so only that region is visited
+  ImageView<const uint8_t> region_two = ObjectRegion(image_two.view(), image_three.view(), threshold);
+  ImageView<const uint8_t> region_three = image_three.view(region_two.first_row(), region_two.first_column(),
+                                                       region_two.num_rows(), region_two.num_columns());
+  Image<uint8_t> *needle_map = DrawNeedleMap(directions, &image_one, region_two, region_three, step, threshold);
+
+  if (!WriteImage(output_image, *needle_map)){
+    cout << "Can't write to file " << output_image << endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char **argv){
   
   if (argc!=8) {
     printf("Usage: %s input_directions.txt image1.pgm image2.pgm image3.pgm step threshold output_needle_image_filename.pgm\n", argv[0]);
+    printf("   or: %s directions_file_or_directory image1_directory_or_@list image2_file_or_directory image3_file_or_directory step threshold output_directory\n", argv[0]);
     return 0;
   }
   const string input_directions(argv[1]);
@@ -147,27 +199,27 @@ int main(int argc, char **argv){
   const string threshold(argv[6]);
   const string output_image(argv[7]);
 
-  Image image_one;
-  if (!ReadImage(input_image_one, &image_one)) {
-    cout <<"Can't open file " << input_image_one << endl;
-    return 0;
-  }
-  Image image_two;
-  if (!ReadImage(input_image_two, &image_two)) {
-    cout <<"Can't open file " << input_image_two << endl;
-    return 0;
-  }
-  Image image_three;
-  if (!ReadImage(input_image_three, &image_three)) {
-    cout <<"Can't open file " << input_image_three << endl;
+  // batch mode: one needle map per image of the first directory (or list), drawn in parallel,
+  // the directions and the other two images being the files with the same name in the other arguments
+  if (IsBatchArgument(input_image_one)) {
+    BatchInput inputs;
+    BatchInput directions;
+    BatchInput images_two;
+    BatchInput images_three;
+    if (!inputs.Open(input_image_one) || !directions.Open(input_directions) || !images_two.Open(input_image_two) ||
+        !images_three.Open(input_image_three) || !MakeDirectory(output_image)) return 0;
+    ThreadPool pool;
+    vector<vector<Image<uint8_t>>> images(pool.num_threads(), vector<Image<uint8_t>>(3));
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      string frame_directions, frame_two, frame_three;
+      if (!directions.Find(stem, &frame_directions) || !images_two.Find(stem, &frame_two) || !images_three.Find(stem, &frame_three)) return false;
+      return NeedleMapFile(frame_directions, image_file, frame_two, frame_three, stoi(step), stoi(threshold), OutputFilename(output_image, stem, ".pgm"), &images[worker]);
+    });
     return 0;
   }
 
-  vector<double> directions = ReadDirectionFile(input_directions);
-  Image *needle_map = DrawNeedleMap(directions, &image_one, &image_two, &image_three, stoi(step), stoi(threshold));
-
-  if (!WriteImage(output_image, *needle_map)){
-    cout << "Can't write to file " << output_image << endl;
-    return 0;
-  }
+  vector<Image<uint8_t>> images(3);
+  NeedleMapFile(input_directions, input_image_one, input_image_two, input_image_three, stoi(step), stoi(threshold), output_image, &images);
 }
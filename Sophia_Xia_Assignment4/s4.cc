@@ -4,9 +4,11 @@
 // calculate the normal magnitude and draw the Albedo image from three images
 // the image is then written to the specified file
 #include "image.h"
+#include "batch.h"
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -83,75 +85,127 @@ double NormalMagnitude(int value_a, int value_b, int value_c, vector<double> dir
 
 /**
  * calculates and draws the Albedo on the image
+ * only the region of the object is visited, the rest of the first image is set to 0
  * @param directions a vector of size 9 that contains 3 light source directions
  * @param one the first image that gets drawn on
- * @param two the second image
- * @param three the third image
+ * @param two view of the object region of the second image
+ * @param three view of the same region of the third image
  * @param threshold
+ * @param pool the pool the magnitudes image is taken from and returned to
  * @return *Image reference to the modified first image
  */
-Image *Albedo(vector<double> directions, Image *one, const Image *two, const Image *three, int threshold){
-  if (one == nullptr || two == nullptr || three == nullptr) abort();
-  int rows = one->num_rows();
-  int cols = one->num_columns();
+Image<uint8_t> *Albedo(vector<double> directions, Image<uint8_t> *one, ImageView<const uint8_t> two, ImageView<const uint8_t> three, int threshold, ImagePool<float> *pool){
+  if (one == nullptr || pool == nullptr) abort();
+  int first_row = two.first_row();
+  int first_col = two.first_column();
+  int rows = two.num_rows();
+  int cols = two.num_columns();
   directions = inverse_matrix(directions);
   double max_magnitude = 0.0;
-  vector<double> magnitudes;
+  Image<float> magnitudes = pool->Acquire(rows, cols);
   for(int r = 0; r < rows; r++){
     for(int c = 0; c < cols; c++){
-      int one_value = one->GetPixel(r,c);
-      int two_value = two->GetPixel(r,c);
-      int three_value = three->GetPixel(r,c);
+      int one_value = one->GetPixel(first_row+r,first_col+c);
+      int two_value = two.GetPixel(r,c);
+      int three_value = three.GetPixel(r,c);
       if(one_value > threshold && two_value > threshold && three_value > threshold){
-        double magnitude = NormalMagnitude(one_value,two_value,three_value, directions);
-        max_magnitude = max(max_magnitude, magnitude);
-        magnitudes.push_back(magnitude);
+        magnitudes.SetPixel(r, c, NormalMagnitude(one_value,two_value,three_value, directions));
+        max_magnitude = max(max_magnitude, static_cast<double>(magnitudes.GetPixel(r, c)));
       }
-      else magnitudes.push_back(0);
     }
   }
+  for(uint8_t &pixel: one->pixels()) pixel = 0;
   for(int r = 0; r < rows; r++){
     for(int c = 0; c < cols; c++){
-      double scaled = 255*magnitudes[r*(cols)+c]/max_magnitude;
-      one->SetPixel(r,c,floor(scaled));
+      double scaled = 255*static_cast<double>(magnitudes.GetPixel(r, c))/max_magnitude;
+      one->SetPixel(first_row+r,first_col+c,floor(scaled));
     }
   }
+  pool->Release(&magnitudes);
   return one;
 }
 
-int main(int argc, char **argv){
-  if (argc!=7) {
-    printf("Usage: %s input_directions.txt image1.pgm image2.pgm image3.pgm threshold output_albedo_image_filename.pgm\n", argv[0]);
-    return 0;
-  }
-  const string input_directions(argv[1]);
-  const string input_image_one(argv[2]);
-  const string input_image_two(argv[3]);
-  const string input_image_three(argv[4]);
-  const string threshold(argv[5]);
-  const string output_image(argv[6]);
-
-  Image image_one;
+/**
+ * Draws the Albedo image of one triple of images and writes it
+ * @param input_directions the light source directions
+ * @param input_image_one the first image, that gets drawn on
+ * @param input_image_two the second image
+ * @param input_image_three the third image
+ * @param threshold
+ * @param output_image the name of the file the Albedo image should be written to
+ * @param images reference to the three image buffers, reused from one triple to the next
+ * @param pool the pool the magnitudes image is taken from and returned to
+ * @return bool true if the images were read and the Albedo image written successfully
+ */
+bool AlbedoFile(const string &input_directions, const string &input_image_one, const string &input_image_two, const string &input_image_three, int threshold, const string &output_image, vector<Image<uint8_t>> *images, ImagePool<float> *pool){
+  if (images == nullptr || images->size() != 3 || pool == nullptr) abort();
+  Image<uint8_t> &image_one = (*images)[0];
   if (!ReadImage(input_image_one, &image_one)) {
     cout <<"Can't open file " << input_image_one << endl;
-    return 0;
+    return false;
   }
-  Image image_two;
+  Image<uint8_t> &image_two = (*images)[1];
   if (!ReadImage(input_image_two, &image_two)) {
     cout <<"Can't open file " << input_image_two << endl;
-    return 0;
+    return false;
   }
-  Image image_three;
+  Image<uint8_t> &image_three = (*images)[2];
   if (!ReadImage(input_image_three, &image_three)) {
     cout <<"Can't open file " << input_image_three << endl;
-    return 0;
+    return false;
   }
 
   vector<double> directions = ReadDirectionFile(input_directions);
-  Image *albedo_image = Albedo(directions, &image_one, &image_two, &image_three, stoi(threshold));
+  // no pixel outside of the object region can pass the threshold, so only that region is visited
+  ImageView<const uint8_t> region_two = ObjectRegion(image_two.view(), image_three.view(), threshold);
+  ImageView<const uint8_t> region_three = image_three.view(region_two.first_row(), region_two.first_column(),
+                                                       region_two.num_rows(), region_two.num_columns());
+  Image<uint8_t> *albedo_image = Albedo(directions, &image_one, region_two, region_three, threshold, pool);
 
   if (!WriteImage(output_image, *albedo_image)){
     cout << "Can't write to file " << output_image << endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv){
+  if (argc!=7) {
+    printf("Usage: %s input_directions.txt image1.pgm image2.pgm image3.pgm threshold output_albedo_image_filename.pgm\n", argv[0]);
+    printf("   or: %s directions_file_or_directory image1_directory_or_@list image2_file_or_directory image3_file_or_directory threshold output_directory\n", argv[0]);
     return 0;
   }
+  const string input_directions(argv[1]);
+  const string input_image_one(argv[2]);
+  const string input_image_two(argv[3]);
+  const string input_image_three(argv[4]);
+  const string threshold(argv[5]);
+  const string output_image(argv[6]);
+
+  // batch mode: one Albedo image per image of the first directory (or list), drawn in parallel,
+  // the directions and the other two images being the files with the same name in the other arguments
+  if (IsBatchArgument(input_image_one)) {
+    BatchInput inputs;
+    BatchInput directions;
+    BatchInput images_two;
+    BatchInput images_three;
+    if (!inputs.Open(input_image_one) || !directions.Open(input_directions) || !images_two.Open(input_image_two) ||
+        !images_three.Open(input_image_three) || !MakeDirectory(output_image)) return 0;
+    ThreadPool pool;
+    vector<vector<Image<uint8_t>>> images(pool.num_threads(), vector<Image<uint8_t>>(3));
+    vector<unique_ptr<ImagePool<float>>> magnitude_pools;
+    for (size_t w = 0; w < pool.num_threads(); ++w) magnitude_pools.emplace_back(new ImagePool<float>(true));
+    ProcessBatch(&pool, inputs, [&](size_t i, size_t worker) -> bool {
+      const string &image_file = inputs.files()[i];
+      const string stem = Stem(image_file);
+      string frame_directions, frame_two, frame_three;
+      if (!directions.Find(stem, &frame_directions) || !images_two.Find(stem, &frame_two) || !images_three.Find(stem, &frame_three)) return false;
+      return AlbedoFile(frame_directions, image_file, frame_two, frame_three, stoi(threshold), OutputFilename(output_image, stem, ".pgm"), &images[worker], magnitude_pools[worker].get());
+    });
+    return 0;
+  }
+
+  vector<Image<uint8_t>> images(3);
+  ImagePool<float> pool(true);
+  AlbedoFile(input_directions, input_image_one, input_image_two, input_image_three, stoi(threshold), output_image, &images, &pool);
 }